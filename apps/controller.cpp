@@ -12,14 +12,18 @@
 #include <chrono>
 #include <cmath>
 #include <condition_variable>
+#include <deque>
 #include <future>
 #include <gpiod.hpp>
 #include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
 #include <pawnshop/config.hpp>
+#include <pawnshop/cup_filler.hpp>
+#include <pawnshop/cycle_time.hpp>
 #include <pawnshop/db.hpp>
 #include <pawnshop/mqtt_handler.hpp>
+#include <pawnshop/path_planner.hpp>
 #include <pawnshop/rails.hpp>
 #include <pawnshop/scales.hpp>
 #include <pawnshop/util.hpp>
@@ -29,6 +33,7 @@
 using namespace std::chrono_literals;
 using namespace std;
 using system_clock = std::chrono::system_clock;
+using steady_clock = std::chrono::steady_clock;
 using namespace pawnshop;
 using namespace pawnshop::vec;
 using json = nlohmann::json;
@@ -44,87 +49,413 @@ class Controller {
     CalibrationInfo calibration_info;
 
     unique_ptr<Scales> scales;
+    unique_ptr<CupFiller> cup_filler;
     unique_ptr<Rails> rails;
     unique_ptr<DevicesConfig> dev;
+    unique_ptr<PathPlanner> planner;
 
     unique_ptr<thread> receiver;
     unique_ptr<thread> task;
+    unique_ptr<thread> move_reporter;
 
     enum State { IDLE, MEASURING, MOVING, CALIBRATING };
 
     atomic<State> state = IDLE;
-    shared_ptr<condition_variable> state_cv;
-
+    // Shared by routine in progress, moves take a copy. Cancelled by stop
+    // and replaced under cancel_mx while no routine reads it.
+    CancellationToken cancel;
+    mutex cancel_mx;
+    // Jobs wait until calibration succeeds
+    atomic<bool> calibrated = false;
+    // Set by stop, so queued jobs are not started until the next request
+    atomic<bool> jobs_held = false;
+    // Follows the queue in db, so receiver doesn't query it on every message
+    atomic<size_t> jobs_pending = 0;
+
+    // Guarded by user_response_mx, which stop also holds while cancelling,
+    // so a waiter can't miss either
     json user_response;
+    bool responded = false;
     mutex user_response_mx;
     shared_ptr<condition_variable> user_response_cv;
 
+    // Scales send about that many samples per second
+    static constexpr double SCALES_RATE = 10.0;
+
+    // Guards job being measured and cycle time
+    mutex jobs_mx;
+    optional<MeasurementJob> current_job;
+    steady_clock::time_point job_start;
+    // Predicted from config, then follows measured cycles
+    chrono::nanoseconds cycle_time;
+
+    // Move commands are executed by stepping thread of rails, their futures
+    // wait here to be reported in order of scheduling
+    struct PendingMove {
+        json id;
+        future<void> done;
+        // Marks rails coming to a stop after stop request
+        bool stop = false;
+    };
+    mutex moves_mx;
+    condition_variable moves_cv;
+    deque<PendingMove> moves;
+    // Scheduled moves not reported yet, including one being waited for
+    size_t moves_pending = 0;
+    int64_t next_move_id = 1;
+
     void recieveMsg() {
         while (!interrupted->load()) {
             MqttMessage msg;
-            if (!incoming_messages->wait_dequeue_timed(msg, 1s)) continue;
-            if (state.load() == IDLE && task != nullptr) {
-                task->join();
-                task.reset();
+            if (incoming_messages->wait_dequeue_timed(msg, 1s)) {
+                handleMsg(msg);
             }
+            // Queued jobs are taken back to back
+            if (state.load() == IDLE && calibrated.load() &&
+                !jobs_held.load() && jobs_pending.load() > 0) {
+                startTask(MEASURING, &Controller::runJobs);
+            }
+        }
+    }
+
+    /**
+     * Runs routine on task thread, routine sets IDLE state when it's done
+     */
+    void startTask(State next, void (Controller::*routine)()) {
+        finishTask();
+        // Stop sees the routine state before the routine reads the token
+        lock_guard lk(cancel_mx);
+        state.store(next);
+        task = make_unique<thread>(&Controller::runTask, this, routine);
+    }
+
+    /**
+     * Reports routine failure instead of letting it terminate controller
+     */
+    void runTask(void (Controller::*routine)()) {
+        try {
+            (this->*routine)();
+        } catch (const exception& e) {
+            spdlog::error("Routine failed in state {}: {}", state.load(),
+                          e.what());
             try {
-                spdlog::debug("Recieved message, topic: {}, current state: {}",
-                              msg.topic, state.load());
-                if (msg.topic == "PawnShop/controller/measure") {
-                    bool flag = msg.payload.get<bool>();
-                    if (state.load() == IDLE && flag) {
-                        // TODO: Add "product_id" to message
-                        task =
-                            make_unique<thread>(&Controller::measure, this, 0);
-                    } else if (state.load() == MEASURING && !flag) {
-                        state.store(IDLE);
-                        state_cv->notify_all();
-                    }
-                } else if (msg.topic == "PawnShop/controller/move") {
-                    Vec3D pos = msg.payload.get<Vec3D>();
-                    spdlog::debug("Moving to (x: {:.1f}, y: {:.1f}, z: {:.1f})",
-                                  pos.at(0), pos.at(1), pos.at(2));
-                    if (state.load() == IDLE) {
-                        state.store(MOVING);
-                        rails->move(pos);
-                        state.store(IDLE);
-                    }
-                } else if (msg.topic == "PawnShop/controller/calibrate") {
-                    bool flag = msg.payload.get<bool>();
-                    if (state.load() == IDLE && flag) {
-                        calibrate();
-                    }
-                } else if (msg.topic ==
-                           "PawnShop/controller/calibration/accept") {
-                    if (state.load() == CALIBRATING) {
-                        {
-                            std::unique_lock lk(user_response_mx);
-                            user_response = msg.payload;
-                        }
-                        user_response_cv->notify_all();
+                mqtt->publish("PawnShop/report/error",
+                              json{{"error", e.what()}}.dump());
+            } catch (const exception& e) {
+                spdlog::error("Failed to report error: {}", e.what());
+            }
+            state.store(IDLE);
+        }
+    }
+
+    void handleMsg(const MqttMessage& msg) {
+        try {
+            spdlog::debug("Recieved message, topic: {}, current state: {}",
+                          msg.topic, state.load());
+            if (msg.topic == "PawnShop/controller/measure") {
+                // Either a job or a flag, true queues a job for product 0
+                if (!msg.payload.is_boolean()) {
+                    enqueue(msg.payload.get<MeasurementJob>());
+                } else if (msg.payload.get<bool>()) {
+                    enqueue({0, 0, 0, {}});
+                } else if (state.load() == MEASURING) {
+                    stop();
+                }
+            } else if (msg.topic == "PawnShop/controller/move") {
+                scheduleMove(msg.payload);
+            } else if (msg.topic == "PawnShop/controller/calibrate") {
+                bool flag = msg.payload.get<bool>();
+                if (state.load() == IDLE && flag) {
+                    // Runs off this thread, since it waits for calibration
+                    // accept message
+                    startTask(CALIBRATING, &Controller::calibrate);
+                }
+            } else if (msg.topic == "PawnShop/controller/stop") {
+                stop();
+            } else if (msg.topic ==
+                       "PawnShop/controller/calibration/accept") {
+                if (state.load() == CALIBRATING) {
+                    {
+                        std::unique_lock lk(user_response_mx);
+                        user_response = msg.payload;
+                        responded = true;
                     }
+                    user_response_cv->notify_all();
                 }
-            } catch (json::exception& e) {
-                spdlog::warn("Ill-formed message on topic \"{}\": {}",
-                             msg.topic, e.what());
             }
+        } catch (json::exception& e) {
+            spdlog::warn("Ill-formed message on topic \"{}\": {}",
+                         msg.topic, e.what());
+        }
+    }
+
+    /**
+     * Schedules move without waiting for it. Payload is either a target
+     * [x, y, z] or {"id": ..., "target": [x, y, z]} or {"id": ..., "path":
+     * [[x, y, z], ...]}, id is assigned when missing. Acknowledgement and
+     * completion are published with the same id.
+     */
+    void scheduleMove(const json& payload) {
+        json id;
+        vector<Vec3D> path;
+        if (payload.is_array()) {
+            path.push_back(payload.get<Vec3D>());
+        } else if (payload.contains("path")) {
+            path = payload.at("path").get<vector<Vec3D>>();
+        } else {
+            path.push_back(payload.at("target").get<Vec3D>());
+        }
+
+        lock_guard lk(moves_mx);
+        if (payload.is_object() && payload.contains("id")) {
+            id = payload.at("id");
+        } else {
+            id = next_move_id++;
+        }
+        json ack = {{"id", id}, {"accepted", false}};
+        const State current = state.load();
+        if (path.empty()) {
+            ack["reason"] = "empty path";
+        } else if (current != IDLE && current != MOVING) {
+            ack["reason"] = "busy";
+        } else {
+            const Vec3D& pos = path.back();
+            spdlog::debug("Moving to (x: {:.1f}, y: {:.1f}, z: {:.1f})",
+                          pos[0], pos[1], pos[2]);
+            if (current == IDLE) {
+                finishTask();
+            }
+            state.store(MOVING);
+            // Moves ahead of this one
+            ack["queued"] = moves_pending++;
+            ack["accepted"] = true;
+            CancellationToken token;
+            {
+                lock_guard cancel_lk(cancel_mx);
+                token = cancel;
+            }
+            moves.push_back({id, rails->moveAsync(path, token)});
+            moves_cv.notify_all();
+        }
+        mqtt->publish("PawnShop/report/move/ack", ack.dump());
+    }
+
+    /**
+     * Publishes completion of scheduled moves, controller becomes IDLE when
+     * the last one is done
+     */
+    void reportMoves() {
+        while (true) {
+            PendingMove current;
+            {
+                unique_lock lk(moves_mx);
+                moves_cv.wait(lk, [this]() {
+                    return !moves.empty() || interrupted->load();
+                });
+                if (moves.empty()) {
+                    return;
+                }
+                current = std::move(moves.front());
+                moves.pop_front();
+            }
+
+            if (current.stop) {
+                current.done.wait();
+                const Vec3D pos = rails->getPos();
+                spdlog::info("Stopped at (x: {:.1f}, y: {:.1f}, z: {:.1f})",
+                             pos[0], pos[1], pos[2]);
+                mqtt->publish("PawnShop/report/stop",
+                              json{{"position", pos}}.dump());
+            } else {
+                json done = {{"id", current.id}, {"ok", true}};
+                try {
+                    current.done.get();
+                } catch (exception& e) {
+                    spdlog::error("Move {} failed: {}", current.id.dump(),
+                                  e.what());
+                    done["ok"] = false;
+                    done["error"] = e.what();
+                }
+                done["position"] = rails->getPos();
+                mqtt->publish("PawnShop/report/move/done", done.dump());
+            }
+
+            lock_guard lk(moves_mx);
+            if (--moves_pending == 0 && state.load() == MOVING) {
+                state.store(IDLE);
+            }
+        }
+    }
+
+    /**
+     * Joins finished routine and gives the next one a fresh token, state
+     * must be IDLE
+     */
+    void finishTask() {
+        if (task) {
+            task->join();
+            task.reset();
+        }
+        lock_guard lk(cancel_mx);
+        cancel = CancellationToken();
+    }
+
+    /**
+     * @throws OperationCancelled if stopped while waiting
+     */
+    void pause(const chrono::nanoseconds time) {
+        if (cancel.sleepFor(time)) {
+            throw OperationCancelled();
         }
     }
 
+    void enqueue(MeasurementJob job) {
+        job.queued_time = system_clock::now();
+        job.id = db->enqueueJob(job);
+        jobs_pending++;
+        jobs_held.store(false);
+        spdlog::info("Queued job {} for product {} with priority {}", job.id,
+                     job.product_id, job.priority);
+        if (!calibrated.load() && state.load() != CALIBRATING) {
+            spdlog::warn("Jobs wait for successful calibration");
+        }
+        publishQueue();
+    }
+
+    /**
+     * Measures queued jobs one after another until queue is empty
+     */
+    void runJobs() {
+        while (!interrupted->load()) {
+            const auto jobs = db->getJobs();
+            if (jobs.empty()) {
+                break;
+            }
+            {
+                lock_guard lk(jobs_mx);
+                current_job = jobs.front();
+                job_start = steady_clock::now();
+            }
+            publishQueue();
+
+            bool stopped = false;
+            try {
+                measure(jobs.front().product_id);
+            } catch (const OperationCancelled&) {
+                // Dropped, so it isn't repeated after recovery
+                spdlog::warn("Job {} stopped and removed from queue",
+                             jobs.front().id);
+                stopped = true;
+            } catch (const exception& e) {
+                // Following jobs would likely fail the same way, so they
+                // wait for the next measure request
+                spdlog::error("Job {} failed and removed from queue: {}",
+                              jobs.front().id, e.what());
+                json failed = jobs.front();
+                failed["error"] = e.what();
+                mqtt->publish("PawnShop/report/job/failed", failed.dump());
+                jobs_held.store(true);
+                stopped = true;
+            }
+            db->removeJob(jobs.front().id);
+            jobs_pending--;
+
+            lock_guard lk(jobs_mx);
+            current_job.reset();
+            if (stopped) {
+                break;
+            }
+            // Smoothed, so a single slow cycle doesn't throw off the ETA
+            cycle_time = (cycle_time + (steady_clock::now() - job_start)) / 2;
+        }
+        publishQueue();
+        state.store(IDLE);
+    }
+
+    /**
+     * Publishes queued jobs with time left until each of them is measured
+     */
+    void publishQueue() {
+        const auto jobs = db->getJobs();
+        json queue = json::array();
+        chrono::nanoseconds eta{0};
+        {
+            lock_guard lk(jobs_mx);
+            if (current_job) {
+                const auto elapsed = steady_clock::now() - job_start;
+                eta += max(cycle_time - elapsed, chrono::nanoseconds{0});
+            }
+            for (const auto& job : jobs) {
+                if (current_job && job.id == current_job->id) {
+                    continue;
+                }
+                eta += cycle_time;
+                json entry = job;
+                entry["eta"] = toSeconds(eta);
+                queue.push_back(entry);
+            }
+        }
+        json payload = {
+            {"depth", jobs.size()}, {"eta", toSeconds(eta)}, {"jobs", queue}};
+        mqtt->publish("PawnShop/report/queue", payload.dump());
+    }
+
+    static int64_t toSeconds(const chrono::nanoseconds time) {
+        return chrono::duration_cast<chrono::seconds>(time).count();
+    }
+
+    /**
+     * @returns Duration of a measurement predicted from config
+     */
+    static chrono::nanoseconds estimateCycleTime(const Config& conf) {
+        // Settling takes at least a full window of samples
+        const auto weighing =
+            chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(
+                conf.scales->settling->window / SCALES_RATE));
+        const CycleTimeEstimator estimator(*conf.rails, *conf.devices,
+                                           weighing);
+        chrono::nanoseconds total{0};
+        for (const auto& phase : estimator.measure()) {
+            total += phase.total();
+        }
+        return total;
+    }
+
     void calibrate() {
         state.store(CALIBRATING);
+        calibrated.store(false);
+        const auto current_info = calibration_info;
+        try {
+            runCalibration();
+            calibrated.store(true);
+        } catch (const OperationCancelled&) {
+            spdlog::warn("Calibration stopped, previous info is kept");
+            calibration_info = current_info;
+        } catch (const exception&) {
+            // Reported by runTask
+            calibration_info = current_info;
+            throw;
+        }
+        state.store(IDLE);
+    }
 
+    void runCalibration() {
         auto prev_info = db->getCalibrationInfo();
 
-        rails->calibrate();
+        auto homing = rails->calibrateAsync(cancel);
         // Move to the safe height to avoid collisions
-        rails->move({0.0, 0.0, dev->safe_height});
-
-        if (!scales->poweredOn()) {
+        auto lifting =
+            rails->moveAsync(Vec3D{0.0, 0.0, dev->safe_height}, cancel);
+        // Scales are checked while carriage is moving
+        const bool scales_on = scales->poweredOn();
+        homing.get();
+        lifting.get();
+
+        if (!scales_on) {
             pressScalesButton();
         }
 
-        double baseline_weight = scales->getWeight().value_or(0);
+        double baseline_weight = weigh();
         bool high_deviation = false;
         bool update_info = true;
 
@@ -157,23 +488,26 @@ class Controller {
         drying();
 
         const auto& reciever_coord = dev->gold_reciever->coordinate;
-        rails->move({reciever_coord[0], reciever_coord[1], dev->safe_height});
+        rails->move(routeTo(planner->above(reciever_coord)), cancel);
 
         json payload = calibration_info;
         payload.update(json{{"high_deviation", high_deviation}});
+        {
+            // Only responses to this report count
+            lock_guard lk(user_response_mx);
+            responded = false;
+        }
         mqtt->publish("PawnShop/report/calibration_info", payload.dump());
 
         if (high_deviation) {
             update_info = false;
 
-            // Wait for response from MQTT
-            {
-                mutex mx;
-                unique_lock lk(mx);
-                user_response_cv->wait(lk);
-            }
-
+            // Wait for response from MQTT, stop wakes it up too
             unique_lock lk(user_response_mx);
+            user_response_cv->wait(
+                lk, [&]() { return responded || cancel.cancelled(); });
+            cancel.throwIfCancelled();
+
             try {
                 update_info = user_response.get<bool>();
             } catch (json::exception& e) {
@@ -188,8 +522,6 @@ class Controller {
         } else if (prev_info.has_value()) {
             calibration_info = prev_info.value();
         }
-
-        state.store(IDLE);
     }
 
     void measure(int64_t product_id) {
@@ -205,9 +537,10 @@ class Controller {
             pressScalesButton();
         }
 
-        // permanent weight control while filling
-        double baseline_weight = scales->getWeight().value_or(0);
-        getGold();
+        // Baseline is measured while carriage picks up gold
+        auto picking_up = getGold();
+        double baseline_weight = weigh();
+        picking_up.get();
 
         m.dirty_weight =
             scaleWeighting(baseline_weight) - calibration_info.caret_weight;
@@ -229,7 +562,7 @@ class Controller {
         }
 
         const auto& reciever_coord = dev->gold_reciever->coordinate;
-        rails->move({reciever_coord[0], reciever_coord[1], dev->safe_height});
+        rails->move(routeTo(planner->above(reciever_coord)), cancel);
 
         m.end_time = system_clock::now();
         // id generated on insertion
@@ -240,18 +573,24 @@ class Controller {
         // removed
         payload.update(calibration_info);
         mqtt->publish("PawnShop/report", payload.dump());
+    }
 
-        state.store(IDLE);
+    /**
+     * @returns Collision free path from current position to target
+     */
+    vector<Vec3D> routeTo(const Vec3D& target) {
+        return planner->route(rails->getPos(), target);
     }
 
-    void getGold() {
+    /**
+     * @returns Future that becomes ready when gold is picked up
+     */
+    future<void> getGold() {
         const auto& reciever_coord = dev->gold_reciever->coordinate;
-        const Vec3D reciever_top_coord = {reciever_coord[0], reciever_coord[1],
-                                          dev->safe_height};
 
-        rails->move(reciever_top_coord);
-        rails->move(reciever_coord);
-        rails->move(reciever_top_coord);
+        auto path = routeTo(reciever_coord);
+        path.push_back(planner->above(reciever_coord));
+        return rails->moveAsync(path, cancel);
     }
 
     void pressScalesButton() {
@@ -259,41 +598,60 @@ class Controller {
         const Vec3D btn_offset_coord = {
             btn_coord[0], dev->gold_reciever->coordinate[1], btn_coord[2]};
 
-        rails->move(btn_offset_coord);
-        rails->move(btn_coord);
-        std::this_thread::sleep_for(1s);
-        rails->move(btn_offset_coord);
-        std::this_thread::sleep_for(1s);
+        auto path = routeTo(btn_offset_coord);
+        path.push_back(btn_coord);
+        rails->move(path, cancel);
+        pause(1s);
+        rails->move(btn_offset_coord, cancel);
+        pause(1s);
     }
 
     void washing() {
         const auto& usbath_coord = dev->ultrasonic_bath->coordinate;
-        const Vec3D usbath_top_coord = {usbath_coord[0], usbath_coord[1],
-                                        dev->safe_height};
+        const Vec3D usbath_top_coord = planner->above(usbath_coord);
 
-        rails->move(usbath_top_coord);
-        rails->move(usbath_coord);
-        std::this_thread::sleep_for(1s);
+        rails->move(routeTo(usbath_coord), cancel);
+        pause(1s);
         mqtt->publish("PawnShop/cmd", "US");
-        std::this_thread::sleep_for(dev->ultrasonic_bath->duration);
+        // Bath is turned off even if stopped
+        cancel.sleepFor(dev->ultrasonic_bath->duration);
         mqtt->publish("PawnShop/cmd", "USoff");
+        cancel.throwIfCancelled();
         // mqtt.publish("PawnShop/cmd", "Empty");
-        rails->move(usbath_top_coord);
-        std::this_thread::sleep_for(1s);
+        rails->move(usbath_top_coord, cancel);
+        pause(1s);
     }
 
     void drying() {
         const auto& dryer_coord = dev->dryer->coordinate;
-        const Vec3D dryer_top_coord = {dryer_coord[0], dryer_coord[1],
-                                       dev->safe_height};
+        const Vec3D dryer_top_coord = planner->above(dryer_coord);
 
-        rails->move(dryer_top_coord);
-        rails->move(dryer_coord);
+        rails->move(routeTo(dryer_coord), cancel);
         mqtt->publish("PawnShop/cmd", "Dry");
-        std::this_thread::sleep_for(dev->dryer->duration);
+        // Dryer is turned off even if stopped
+        cancel.sleepFor(dev->dryer->duration);
         mqtt->publish("PawnShop/cmd", "SDry");
-        std::this_thread::sleep_for(1s);
-        rails->move(dryer_top_coord);
+        pause(1s);
+        rails->move(dryer_top_coord, cancel);
+    }
+
+    /**
+     * @param since: Samples taken before that are not used
+     * @returns Settled weight, best estimate if scales didn't settle, or 0 if
+     * they are off
+     * @throws OperationCancelled if stopped while waiting
+     */
+    double weigh(steady_clock::time_point since = {}) {
+        const auto estimate = scales->getWeight(since, cancel);
+        cancel.throwIfCancelled();
+        if (!estimate) {
+            spdlog::error("Scales are not responding");
+            return 0;
+        }
+        spdlog::debug("Weight {} ± {}{}", estimate->weight,
+                      estimate->uncertainty,
+                      estimate->settled ? "" : ", not settled");
+        return estimate->weight;
     }
 
     /**
@@ -303,14 +661,13 @@ class Controller {
      */
     double scaleWeighting(double baseline_weight) {
         const auto& scale_coord = dev->scales->coordinate;
-        const Vec3D scale_top_coord = {scale_coord[0], scale_coord[1],
-                                       dev->safe_height};
-
-        rails->move(scale_top_coord);
-        rails->move(scale_coord);
-        auto weight = scales->getWeight();
-        rails->move(scale_top_coord);
-        return weight.value_or(0) - baseline_weight;
+        const Vec3D scale_top_coord = planner->above(scale_coord);
+
+        rails->move(routeTo(scale_coord), cancel);
+        // Samples from before the object was put on scales are stale
+        const double weight = weigh(steady_clock::now());
+        rails->move(scale_top_coord, cancel);
+        return weight - baseline_weight;
     }
 
     /**
@@ -322,27 +679,26 @@ class Controller {
      */
     double submergedWeighting(double& baseline_weight) {
         const auto& cup_coord = dev->scales->cup->coordinate;
-        const Vec3D cup_top_coord = {cup_coord[0], cup_coord[1],
-                                     dev->safe_height};
+        const Vec3D cup_top_coord = planner->above(cup_coord);
         const Vec3D cup_bottom_coord = {cup_coord[0], cup_coord[1],
                                         max(cup_coord[2] - 10.0, 0.0)};
 
+        // Cup is filled while carriage moves above it
+        auto approach = rails->moveAsync(routeTo(cup_top_coord), cancel);
         const double desired_weight = dev->scales->cup->desired_weight;
         if (baseline_weight < desired_weight) {
-            mqtt->publish("PawnShop/cmd",
-                          json{{"cmd", "FillCup"},
-                               {"value", desired_weight - baseline_weight}}
-                              .dump());
-            this_thread::sleep_for(1s);
-            baseline_weight = scales->getWeight().value_or(0);
+            cup_filler->fill(baseline_weight, desired_weight,
+                             dev->scales->cup->fill_timeout, cancel);
+            baseline_weight = weigh(steady_clock::now());
         }
-
-        rails->move(cup_top_coord);
-        rails->move(cup_bottom_coord);
-        rails->move(cup_coord);
-        auto weight = scales->getWeight();
-        rails->move(cup_top_coord);
-        return weight.value_or(0) - baseline_weight;
+        approach.get();
+
+        auto path = routeTo(cup_bottom_coord);
+        path.push_back(cup_coord);
+        rails->move(path, cancel);
+        const double weight = weigh(steady_clock::now());
+        rails->move(cup_top_coord, cancel);
+        return weight - baseline_weight;
     }
 
 public:
@@ -352,24 +708,83 @@ public:
         : mqtt(mqtt),
           incoming_messages(incoming_messages),
           interrupted(interrupted) {
+        // Estimated before configs are handed over to their users
+        cycle_time = estimateCycleTime(*config);
         scales = make_unique<Scales>(move(config->scales));
-        rails = make_unique<Rails>(move(config->rails));
+        cup_filler = make_unique<CupFiller>(
+            *scales,
+            [this](const double amount) {
+                this->mqtt->publish(
+                    "PawnShop/cmd",
+                    json{{"cmd", "FillCup"}, {"value", amount}}.dump());
+            },
+            [this]() { this->mqtt->publish("PawnShop/cmd", "SFillCup"); });
+        rails = make_unique<Rails>(move(config->rails),
+                                   move(config->realtime));
         dev = move(config->devices);
+        const auto boxes = dev->boundingBoxes();
+        if (!boxes) {
+            spdlog::info("Not every device has a bounding box, carriage "
+                         "climbs to safe height {} between devices",
+                         dev->safe_height);
+        }
+        planner = make_unique<PathPlanner>(boxes, dev->safe_height);
 
         db = make_unique<Db>(move(config->db));
+        jobs_pending.store(db->getJobs().size());
 
+        user_response_cv = make_shared<condition_variable>();
+        // Queued jobs wait for calibration. It runs on task thread, so
+        // caller can stop it like any other routine.
+        state.store(CALIBRATING);
+        task = make_unique<thread>(&Controller::runTask, this,
+                                   &Controller::calibrate);
         receiver = make_unique<thread>(&Controller::recieveMsg, this);
-        state_cv = make_unique<condition_variable>();
+        move_reporter = make_unique<thread>(&Controller::reportMoves, this);
+    }
 
-        calibrate();
+    /**
+     * Stops motion and routine in progress, carriage ramps down and stays
+     * where it stopped. Reached position is published once rails are idle,
+     * queued jobs wait for the next measure request. Safe to call from any
+     * thread.
+     */
+    void stop() {
+        spdlog::warn("Stop requested, current state: {}", state.load());
+        {
+            lock_guard response_lk(user_response_mx);
+            lock_guard lk(cancel_mx);
+            cancel.cancel();
+            // Moves keep their copy, so ones scheduled after the stop get a
+            // fresh token right away. Routine gets one once it's joined.
+            const State current = state.load();
+            if (current != MEASURING && current != CALIBRATING) {
+                cancel = CancellationToken();
+            }
+        }
+        jobs_held.store(true);
+        user_response_cv->notify_all();
+
+        lock_guard lk(moves_mx);
+        moves_pending++;
+        moves.push_back({nullptr, rails->whenIdle(), true});
+        moves_cv.notify_all();
     }
 
     ~Controller() {
-        state.store(IDLE);
-        state_cv->notify_all();
-
         if (receiver) receiver->join();
+        // Routine in progress is not waited out
+        {
+            lock_guard lk(user_response_mx);
+            cancel.cancel();
+        }
+        user_response_cv->notify_all();
         if (task) task->join();
+        {
+            lock_guard lk(moves_mx);
+            moves_cv.notify_all();
+        }
+        if (move_reporter) move_reporter->join();
 
         if (mqtt->is_connected()) mqtt->disconnect()->wait();
     }
@@ -381,6 +796,7 @@ int main(int argc, char** argv) {
     sigemptyset(&sigset);
     sigaddset(&sigset, SIGINT);
     sigaddset(&sigset, SIGTERM);
+    sigaddset(&sigset, SIGUSR1);
     pthread_sigmask(SIG_BLOCK, &sigset, nullptr);
 
     auto shutdown_requested = make_shared<atomic<bool>>(false);
@@ -407,7 +823,10 @@ int main(int argc, char** argv) {
     Controller controller(config, mqtt, incoming_messages, shutdown_requested);
 
     int signum = 0;
-    sigwait(&sigset, &signum);
+    // SIGUSR1 is an emergency stop, i.e. sent by a stop button handler
+    while (sigwait(&sigset, &signum) == 0 && signum == SIGUSR1) {
+        controller.stop();
+    }
     shutdown_requested->store(true);
     shutdown_cv->notify_all();
     spdlog::info("Recieved signal, terminating");
@@ -0,0 +1,52 @@
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <memory>
+#include <pawnshop/config.hpp>
+#include <pawnshop/cycle_time.hpp>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace std::chrono;
+using namespace pawnshop;
+
+void printPhases(const string& title, const vector<PhaseTime>& phases) {
+    const auto sec = [](const nanoseconds time) {
+        return duration<double>(time).count();
+    };
+    fmt::print("{}\n", title);
+    nanoseconds motion{0}, waiting{0};
+    for (const auto& phase : phases) {
+        fmt::print("  {:<26}{:>8.1f}s  (motion {:.1f}s, waiting {:.1f}s)\n",
+                   phase.name, sec(phase.total()), sec(phase.motion),
+                   sec(phase.waiting));
+        motion += phase.motion;
+        waiting += phase.waiting;
+    }
+    fmt::print("  {:<26}{:>8.1f}s  (motion {:.1f}s, waiting {:.1f}s)\n",
+               "Total", sec(motion + waiting), sec(motion), sec(waiting));
+}
+
+/**
+ * Prints how long measurement and calibration take with given config.
+ *
+ * Usage: cycle_time [config.toml] [scales samples per second]
+ */
+int main(int argc, char** argv) {
+    spdlog::set_level(spdlog::level::warn);
+    const string path = argc > 1 ? argv[1] : "./dist/config.toml";
+    // Scales send a line about every 100ms
+    const double scales_rate = argc > 2 ? stod(argv[2]) : 10.0;
+
+    Config config(path);
+    // Settling takes at least a full window of samples
+    const auto weighing = duration_cast<nanoseconds>(
+        duration<double>(config.scales->settling->window / scales_rate));
+    const CycleTimeEstimator estimator(*config.rails, *config.devices,
+                                       weighing);
+    printPhases("Measurement", estimator.measure());
+    printPhases("Calibration", estimator.calibrate());
+    return 0;
+}
@@ -1,12 +1,13 @@
 #pragma once
+#include <atomic>
+#include <chrono>
 #include <functional>
-#include <mutex>
 #include <optional>
-#include <shared_mutex>
-#include <gpiod.hpp>
 #include <toml++/toml_table.hpp>
 
+#include "gpio.hpp"
 #include "limit_switch.hpp"
+#include "motion_profile.hpp"
 #include "motor.hpp"
 
 namespace pawnshop {
@@ -17,45 +18,119 @@ struct AxisConfig {
     double min_speed;
     double max_speed;
     double acceleration;
+    // Optional, 0 means trapezoidal acceleration profile
+    double jerk;
+    // Homing approaches limit switch at fast speed, backs off and approaches
+    // again at slow speed. Carriage ramps down from fast speed once switch
+    // trips, so the ramp has to fit into overtravel. Slow speed can't exceed
+    // min_speed, carriage stops at the switch without ramping down.
+    double homing_fast_speed;
+    double homing_slow_speed;
+    // mm
+    double homing_backoff;
+    // mm carriage can travel past the point switch trips at
+    double homing_overtravel;
     std::unique_ptr<MotorConfig> motor;
     std::unique_ptr<LimitSwitchConfig> negative;
 
     AxisConfig(const toml::table& table);
+    /**
+     * Deep copy, motor and limit switch configs are copied as well
+     */
+    AxisConfig(const AxisConfig& other);
 };
 
 class Axis {
     explicit Axis(const double axis_length, const uint32_t step_count,
                   const double min_speed, const double max_speed,
-                  const double axeleration, Motor&& motor,
-                  LimitSwitch&& negative);
+                  const double axeleration, const double jerk,
+                  const double homing_fast_speed,
+                  const double homing_slow_speed, const double homing_backoff,
+                  Motor&& motor, LimitSwitch&& negative);
 public:
-    explicit Axis(gpiod::chip chip, const std::unique_ptr<AxisConfig> conf);
+    /**
+     * @param channel index of axis motor in bus
+     */
+    explicit Axis(gpio::Backend& backend, std::shared_ptr<StepBus> bus,
+                  const size_t channel, const std::unique_ptr<AxisConfig> conf);
     Axis(const Axis&) = delete;
     Axis(Axis&&);
     Axis& operator=(const Axis&) = delete;
     Axis& operator=(Axis&&) = delete;
-    void calibrate();
     /**
-     * @param scaling scales speeds and acceleration to sync axes movement
+     * Homing split into single steps, so several axes can be homed on one
+     * timeline. Approaches negative limit switch fast, ramps down past it,
+     * backs off and approaches it again slowly, then switch becomes
+     * position 0.
+     */
+    class Homing {
+    public:
+        /**
+         * @param position_known: Axis was homed before, so it rushes at
+         * max_speed to backoff distance short of the switch first
+         */
+        explicit Homing(Axis& axis, bool position_known = false);
+        /**
+         * Prepares the next step, which is made on the next rising edge of
+         * axis clock line
+         *
+         * @returns Interval between that step and the one after it, {} when
+         * homing is finished
+         * @throws std::runtime_error if switch isn't reached within axis
+         * length
+         */
+        std::optional<std::chrono::nanoseconds> next();
+
+    private:
+        enum Phase { RAPID, FAST, BRAKE, BACKOFF, SLOW, DONE };
+
+        Axis& axis;
+        Phase phase;
+        std::optional<StepProfile> profile;
+        uint64_t step;
+        // Last returned interval, gives current speed
+        std::chrono::nanoseconds last{0};
+        // Steps made past the switch while ramping down
+        uint64_t overshoot = 0;
+
+        void startPhase(const Phase next);
+        double currentSpeed() const;
+    };
+
+    /**
+     * @returns Signed amount of steps from current position to new_pos
+     */
+    int64_t stepsTo(const double new_pos) const;
+    double getStepLength() const;
+    ProfileLimits getLimits() const;
+    void setDirection(const Motor::Direction dir);
+    /**
+     * Updates position for a step made on the next rising edge of clock
+     * lines in getClockMask()
+     *
+     * @returns False if movement is blocked by limit switch
      */
-    void move(const double new_pos, const double scaling);
-    double getPosition();
+    bool advance();
+    StepBus::Mask getClockMask() const;
+    double getPosition() const;
 
 private:
     const double MIN_SPEED;
     const double MAX_SPEED;
     const double ACCELERATION;
+    const double JERK;
+    const double HOMING_FAST_SPEED;
+    const double HOMING_SLOW_SPEED;
+    const double HOMING_BACKOFF;
     Motor motor;
     const double axis_length;
     const double step_length;
     std::optional<LimitSwitch> negative;
-    std::shared_mutex position_mx;
-    double position;
-    void step(uint32_t steps);
-    void setSpeed(double speed);
+    // Counted in steps, so stepping loop doesn't lock and rounding errors
+    // don't accumulate
+    std::atomic<int64_t> position{0};
     void setPosition(const double new_pos);
-    void incPosition(const double inc);
-    double getSpeed() const;
+    void incPosition(const int64_t steps);
 };
 
 }  // namespace pawnshop
@@ -1,11 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <optional>
 #include <string>
+#include <vector>
 
 #include "pawnshop/db.hpp"
 #include "pawnshop/mqtt_handler.hpp"
+#include "pawnshop/path_planner.hpp"
 #include "pawnshop/rails.hpp"
+#include "pawnshop/realtime.hpp"
 #include "pawnshop/scales.hpp"
 #include "pawnshop/vec.hpp"
 
@@ -17,6 +21,7 @@ struct DevicesConfig {
     struct Dryer {
         vec::Vec3D coordinate;
         std::chrono::seconds duration;
+        std::optional<BoundingBox> bounding_box;
 
         Dryer(const toml::table& table);
     };
@@ -25,6 +30,7 @@ struct DevicesConfig {
     struct UltrasonicBath {
         vec::Vec3D coordinate;
         std::chrono::seconds duration;
+        std::optional<BoundingBox> bounding_box;
 
         UltrasonicBath(const toml::table& table);
     };
@@ -32,9 +38,12 @@ struct DevicesConfig {
 
     struct Scales {
         vec::Vec3D coordinate;
+        std::optional<BoundingBox> bounding_box;
         struct Cup {
             vec::Vec3D coordinate;
             double desired_weight;
+            // Pump is stopped after that even if cup is not filled
+            std::chrono::seconds fill_timeout;
 
             Cup(const toml::table& table);
         };
@@ -53,21 +62,26 @@ struct DevicesConfig {
 
     struct GoldReciever {
         vec::Vec3D coordinate;
+        std::optional<BoundingBox> bounding_box;
 
         GoldReciever(const toml::table& table);
     };
     std::unique_ptr<GoldReciever> gold_reciever;
 
     DevicesConfig(const toml::table& table);
+    /**
+     * @returns Bounding boxes of all devices, or {} if some are not defined
+     */
+    std::optional<std::vector<BoundingBox>> boundingBoxes() const;
 };
 
 class Config {
-    Config(const std::string& toml_path);
-
 public:
+    Config(const std::string& toml_path);
     std::unique_ptr<DbConfig> db;
     std::unique_ptr<ScalesConfig> scales;
     std::unique_ptr<RailsConfig> rails;
+    std::unique_ptr<RealtimeConfig> realtime;
     std::unique_ptr<DevicesConfig> devices;
     std::unique_ptr<MqttConfig> mqtt;
 
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+
+#include "scales.hpp"
+
+namespace pawnshop {
+
+struct FillResult {
+    // Weight at the moment pump was told to stop
+    double weight;
+    // False if target was not reached before timeout
+    bool reached;
+    std::chrono::nanoseconds time;
+};
+
+/**
+ * Fills cup standing on scales in a closed loop. Pump runs until scales
+ * show target weight, instead of pouring a computed amount and waiting a
+ * fixed time.
+ */
+class CupFiller {
+public:
+    using StartPump = std::function<void(double amount)>;
+    using StopPump = std::function<void()>;
+
+    CupFiller(Scales& scales, StartPump start, StopPump stop);
+    /**
+     * Starts pump with the missing amount and stops it as soon as weight
+     * reaches target, on timeout or when cancelled
+     *
+     * @param from: Current weight of the cup
+     */
+    FillResult fill(const double from, const double target,
+                    const std::chrono::nanoseconds timeout,
+                    const CancellationToken& cancel = {});
+
+private:
+    Scales& scales;
+    StartPump start;
+    StopPump stop;
+};
+
+}  // namespace pawnshop
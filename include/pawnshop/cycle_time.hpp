@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "motion_plan.hpp"
+#include "path_planner.hpp"
+#include "vec.hpp"
+
+namespace pawnshop {
+
+struct PhaseTime {
+    std::string name;
+    std::chrono::nanoseconds motion{0};
+    // Device cycles, fixed pauses and weighing not overlapped by motion
+    std::chrono::nanoseconds waiting{0};
+
+    std::chrono::nanoseconds total() const;
+};
+
+/**
+ * Predicts duration of controller routines from config, using the same path
+ * planning and step profiles as rails. Scales are assumed to be on and cup
+ * to be filled, operator responses are not included.
+ */
+class CycleTimeEstimator {
+public:
+    /**
+     * @param devices: Referenced by estimator, has to outlive it
+     * @param weighing: Time scales take to give a stable weight
+     */
+    CycleTimeEstimator(const RailsConfig& rails, const DevicesConfig& devices,
+                       const std::chrono::nanoseconds weighing);
+    /**
+     * @returns Phases of a single measurement, starting and ending with
+     * carriage parked above gold reciever
+     */
+    std::vector<PhaseTime> measure() const;
+    /**
+     * @returns Phases of calibration, homing starts from the far ends of axes
+     */
+    std::vector<PhaseTime> calibrate() const;
+    /**
+     * @returns Time it takes to move through waypoints
+     */
+    std::chrono::nanoseconds moveTime(
+        const vec::Vec3D& from, const std::vector<vec::Vec3D>& waypoints) const;
+    /**
+     * @returns Time all homing groups take one after another
+     */
+    std::chrono::nanoseconds homingTime() const;
+
+private:
+    class Trip;
+
+    RailsKinematics kinematics;
+    std::vector<std::vector<size_t>> homing_order;
+    // Worst case, homing from the far end of axis
+    std::array<std::chrono::nanoseconds, 3> axis_homing;
+    const DevicesConfig& dev;
+    PathPlanner planner;
+    std::chrono::nanoseconds weighing;
+};
+
+}  // namespace pawnshop
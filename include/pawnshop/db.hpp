@@ -36,6 +36,18 @@ struct CalibrationInfo {
 void to_json(nlohmann::json& j, const CalibrationInfo& p);
 void from_json(const nlohmann::json& j, CalibrationInfo& p);
 
+struct MeasurementJob {
+    // Automatically generated id, also the order jobs were queued in
+    int64_t id;
+    int64_t product_id;
+    // Jobs with higher priority are taken first, equal ones in queue order
+    int64_t priority;
+    std::chrono::time_point<std::chrono::system_clock> queued_time;
+};
+
+void to_json(nlohmann::json& j, const MeasurementJob& p);
+void from_json(const nlohmann::json& j, MeasurementJob& p);
+
 struct DbConfig {
     std::string path;
 
@@ -61,6 +73,20 @@ public:
     std::vector<Measurement> getAllMeasurements();
     size_t getMeasurementsAmount();
 
+    /**
+     * @returns Id of new job
+     */
+    int64_t enqueueJob(const MeasurementJob& j);
+    /**
+     * @returns Queued jobs in the order they are taken
+     */
+    std::vector<MeasurementJob> getJobs();
+    /**
+     * Jobs stay queued until removed, so a job interrupted by restart is
+     * taken again
+     */
+    void removeJob(int64_t id);
+
 private:
     Db(const std::string& db_path);
     sqlite3* db = nullptr;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <gpiod.hpp>
+
+namespace pawnshop {
+namespace gpio {
+
+/**
+ * Group of output lines written with a single request
+ */
+class Outputs {
+public:
+    virtual ~Outputs() = default;
+    /**
+     * @param values: Level of every line in order of request
+     */
+    virtual void setValues(const std::vector<int>& values) = 0;
+};
+
+class Input {
+public:
+    virtual ~Input() = default;
+    virtual int getValue() const = 0;
+};
+
+/**
+ * Source of GPIO lines, so motion code can run on hardware as well as on
+ * simulated rails
+ */
+class Backend {
+public:
+    virtual ~Backend() = default;
+    /**
+     * Requests lines as outputs, all set to low
+     */
+    virtual std::unique_ptr<Outputs> requestOutputs(
+        const std::vector<size_t>& pins, const std::string& consumer) = 0;
+    virtual std::unique_ptr<Input> requestInput(
+        const size_t pin, const std::string& consumer) = 0;
+};
+
+/**
+ * Lines of a real chip accessed through libgpiod
+ */
+class GpiodBackend : public Backend {
+public:
+    explicit GpiodBackend(const std::string& chip_name);
+    std::unique_ptr<Outputs> requestOutputs(
+        const std::vector<size_t>& pins, const std::string& consumer) override;
+    std::unique_ptr<Input> requestInput(const size_t pin,
+                                        const std::string& consumer) override;
+
+private:
+    gpiod::chip chip;
+};
+
+}  // namespace gpio
+}  // namespace pawnshop
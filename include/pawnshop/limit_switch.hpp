@@ -1,8 +1,10 @@
 #pragma once
 
-#include <gpiod.hpp>
+#include <memory>
 #include <toml++/toml_table.hpp>
 
+#include "gpio.hpp"
+
 namespace pawnshop {
 
 struct LimitSwitchConfig {
@@ -12,9 +14,10 @@ struct LimitSwitchConfig {
 };
 
 class LimitSwitch {
-    LimitSwitch(gpiod::chip chip, size_t offset);
+    LimitSwitch(gpio::Backend& backend, size_t offset);
 public:
-    LimitSwitch(gpiod::chip chip, const std::unique_ptr<LimitSwitchConfig> conf);
+    LimitSwitch(gpio::Backend& backend,
+                const std::unique_ptr<LimitSwitchConfig> conf);
     LimitSwitch() = delete;
     LimitSwitch(const LimitSwitch&) = delete;
     LimitSwitch(LimitSwitch&&) = default;
@@ -26,7 +29,7 @@ public:
     operator bool() const;
 
 private:
-    gpiod::line line;
+    std::unique_ptr<gpio::Input> line;
 };
 
 }  // namespace pawnshop
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "motion_profile.hpp"
+#include "vec.hpp"
+
+namespace pawnshop {
+
+struct AxisKinematics {
+    double step_length;
+    ProfileLimits limits;
+};
+
+using RailsKinematics = std::array<AxisKinematics, 3>;
+
+/**
+ * Straight move between two waypoints. Axis with the most steps makes a step
+ * on every tick, other axes are interpolated with Bresenham's algorithm.
+ */
+struct Segment {
+    std::array<int64_t, 3> steps;
+    uint64_t ticks;
+    // mm
+    double length;
+    vec::Vec3D direction;
+    // Limits along the path, set by the axis that reaches its own limit first
+    ProfileLimits limits;
+    double entry_speed = 0;
+    double exit_speed = 0;
+
+    /**
+     * @param from: Position of every axis in steps
+     */
+    Segment(const RailsKinematics& axes, const std::array<int64_t, 3>& from,
+            const std::array<int64_t, 3>& to);
+    StepProfile profile() const;
+};
+
+/**
+ * @returns Position of every axis in steps, rounded to the nearest step
+ */
+std::array<int64_t, 3> toSteps(const RailsKinematics& axes,
+                               const vec::Vec3D& pos);
+
+/**
+ * Splits path through waypoints into segments and plans speed at every
+ * junction with look-ahead over the whole path, so carriage stops only at
+ * the end and where direction changes too sharply. Allowed instant change of
+ * speed at a junction is min_speed of every axis. Profiles never go below
+ * min_speed, so junctions that need less are planned as full stops, with
+ * exit and entry speed 0.
+ *
+ * @param from: Current position of every axis in steps
+ */
+std::vector<Segment> planPath(const RailsKinematics& axes,
+                              const std::array<int64_t, 3>& from,
+                              const std::vector<vec::Vec3D>& waypoints);
+
+}  // namespace pawnshop
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace pawnshop {
+
+struct ProfileLimits {
+    // Speed at which motor can start and stop without ramping, mm/s
+    double min_speed;
+    // mm/s
+    double max_speed;
+    // mm/s^2
+    double acceleration;
+    // mm/s^3, 0 disables jerk limiting and gives trapezoidal profile
+    double jerk = 0;
+};
+
+/**
+ * @returns Distance needed to change speed between v_from and v_to
+ */
+double rampDistance(const double v_from, const double v_to,
+                    const ProfileLimits& limits);
+
+/**
+ * @returns Highest speed that can be reached from v_from over given distance
+ */
+double reachableSpeed(const double v_from, const double distance,
+                      const ProfileLimits& limits);
+
+/**
+ * Precomputed schedule of intervals between steps for a move of given length.
+ * Speed ramps up from entry speed, stays constant and ramps down to exit
+ * speed. Speeds below min_speed are treated as min_speed, since motor can
+ * start and stop at it without ramping.
+ */
+class StepProfile {
+public:
+    StepProfile(const uint64_t steps, const double step_length,
+                const ProfileLimits& limits, const double entry_speed = 0,
+                const double exit_speed = 0);
+    /**
+     * @returns Amount of steps in the move
+     */
+    uint64_t size() const;
+    /**
+     * @returns Time between given step and the next one
+     */
+    std::chrono::nanoseconds interval(const uint64_t step) const;
+    /**
+     * @returns Total time of the move
+     */
+    std::chrono::nanoseconds duration() const;
+    /**
+     * @returns Highest speed reached during the move, mm/s
+     */
+    double peakSpeed() const;
+    /**
+     * @returns Speeds the move starts and ends with, requested ones are
+     * raised to min_speed
+     */
+    double entrySpeed() const;
+    double exitSpeed() const;
+
+private:
+    uint64_t steps;
+    // Deceleration is stored in reverse order
+    std::vector<std::chrono::nanoseconds> accel, decel;
+    std::chrono::nanoseconds cruise;
+    double peak_speed, entry_speed, exit_speed;
+};
+
+}  // namespace pawnshop
@@ -1,13 +1,10 @@
 #pragma once
 
-#include <array>
-#include <atomic>
 #include <chrono>
-#include <future>
-#include <gpiod.hpp>
+#include <memory>
 #include <toml++/toml_table.hpp>
 
-#include "limit_switch.hpp"
+#include "step_bus.hpp"
 
 namespace pawnshop {
 
@@ -20,32 +17,32 @@ struct MotorConfig {
 };
 
 class Motor {
-    explicit Motor(const gpiod::chip gpio_chip, const size_t clock_line_offset,
-                   const size_t dir_line_offset, bool inverted);
-    explicit Motor(gpiod::line clock_line, gpiod::line dir_line,
-                   bool inverted = false);
-
 public:
-    explicit Motor(gpiod::chip chip, const std::unique_ptr<MotorConfig> conf);
+    /**
+     * @param channel index of motor lines in bus
+     */
+    explicit Motor(std::shared_ptr<StepBus> bus, const size_t channel,
+                   bool inverted = false);
+    explicit Motor(std::shared_ptr<StepBus> bus, const size_t channel,
+                   const std::unique_ptr<MotorConfig> conf);
     enum Direction : int8_t { NEGATIVE = -1, POSITIVE = 1 };
     Motor() = delete;
     Motor(const Motor&) = delete;
     Motor(Motor&&);
     Motor& operator=(const Motor&) = delete;
     Motor& operator=(Motor&&) = delete;
-    int16_t step() const;
+    /**
+     * @returns Bit of this motor for bus operations on several motors
+     */
+    StepBus::Mask getClockMask() const;
     void setDirection(const Direction dir);
     Direction getDirection() const;
-    void setFrequency(const uint32_t hz);
-    int32_t getFrequency() const;
 
 private:
-    gpiod::line clock_line, dir_line;
+    std::shared_ptr<StepBus> bus;
+    const size_t channel;
     Direction dir;
     const bool inverted;
-    bool stopped = true;
-    std::atomic<std::chrono::nanoseconds> period;
-    void setPeriod(const std::chrono::nanoseconds period);
 };
 
 }  // namespace pawnshop
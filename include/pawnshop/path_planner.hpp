@@ -0,0 +1,51 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+
+#include "vec.hpp"
+
+namespace pawnshop {
+
+struct BoundingBox {
+    vec::Vec3D min;
+    vec::Vec3D max;
+    // Height kept above the box when passing over it, mm
+    double clearance;
+};
+
+/**
+ * Plans paths around devices. Carriage enters and leaves devices vertically
+ * and passes over everything in between at the lowest height that clears
+ * all boxes under the path, since Z travel dominates move time.
+ */
+class PathPlanner {
+public:
+    /**
+     * @param boxes: Bounding boxes of all devices, {} in case some device
+     * isn't described, then every path passes at safe_height
+     */
+    PathPlanner(std::optional<std::vector<BoundingBox>> boxes,
+                const double safe_height);
+    /**
+     * @returns Waypoints of collision free path, not including start
+     */
+    std::vector<vec::Vec3D> route(const vec::Vec3D& from,
+                                  const vec::Vec3D& to) const;
+    /**
+     * @returns Lowest point above coordinate, from which carriage can move
+     * freely
+     */
+    vec::Vec3D above(const vec::Vec3D& coord) const;
+
+private:
+    std::optional<std::vector<BoundingBox>> boxes;
+    const double safe_height;
+
+    /**
+     * @returns Height that clears all boxes under XY projection of the path
+     */
+    double passingHeight(const vec::Vec3D& from, const vec::Vec3D& to) const;
+};
+
+}  // namespace pawnshop
@@ -1,35 +1,148 @@
 #pragma once
 
 #include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
 #include <mutex>
-#include <shared_mutex>
-#include <gpiod.hpp>
+#include <optional>
+#include <thread>
+#include <vector>
 
 #include "axis.hpp"
+#include "gpio.hpp"
+#include "motion_plan.hpp"
+#include "realtime.hpp"
+#include "step_bus.hpp"
+#include "step_timer.hpp"
+#include "util.hpp"
 #include "vec.hpp"
 
 namespace pawnshop {
 
 struct RailsConfig {
     std::string gpio_chip;
+    // "gpiod" for real hardware or "simulated" to run without it
+    std::string backend;
     std::array<std::unique_ptr<AxisConfig>, 3> axes;
+    // Groups of axis indices homed one after another, axes of a group are
+    // homed together. Axes missing from config are homed in the last group.
+    std::vector<std::vector<size_t>> homing_order;
+    // Time drivers need between direction change and step
+    std::chrono::nanoseconds direction_setup;
 
     RailsConfig(const toml::table& table);
 };
 
 class Rails {
 public:
-    Rails(const std::unique_ptr<RailsConfig> conf);
+    /**
+     * @param realtime: Scheduling of stepping thread, default when nullptr
+     */
+    Rails(const std::unique_ptr<RailsConfig> conf,
+          std::unique_ptr<RealtimeConfig> realtime = nullptr);
+    /**
+     * @param backend: Used instead of the one set in config, i.e. to inspect
+     * simulated rails
+     */
+    Rails(const std::unique_ptr<RailsConfig> conf,
+          std::shared_ptr<gpio::Backend> backend,
+          std::unique_ptr<RealtimeConfig> realtime = nullptr);
     Rails(const Rails&) = delete;
-    Rails(Rails&&) = default;
-    ~Rails() = default;
-    void move(const pawnshop::vec::Vec3D newPos);
-    void calibrate();
+    Rails(Rails&&) = delete;
+    ~Rails();
+    /**
+     * Moves in a straight line, all axes are stepped from a single thread
+     * with shared timeline. Cancelled move ramps down to min_speed at full
+     * acceleration and stops there, wherever that is.
+     *
+     * @throws OperationCancelled if cancelled
+     * @throws std::runtime_error if calibration scheduled before didn't
+     * finish, since position is unknown then
+     */
+    void move(const pawnshop::vec::Vec3D newPos,
+              const CancellationToken& cancel = {});
+    /**
+     * Moves through all waypoints without stopping at junctions, unless
+     * direction changes too sharply
+     */
+    void move(const std::vector<pawnshop::vec::Vec3D>& waypoints,
+              const CancellationToken& cancel = {});
+    /**
+     * Homes axes in groups set by homing_order, all axes of a group are
+     * stepped together on a single timeline. When rails were homed before,
+     * axes rush close to the switches at max_speed first. Cancelled homing
+     * ramps down the same way as a move and leaves rails uncalibrated.
+     */
+    void calibrate(const CancellationToken& cancel = {});
+    /**
+     * Same as move, but returns right after scheduling. Moves are executed
+     * in order of scheduling, path is planned from position reached by
+     * previous move. Moves cancelled before they start are skipped.
+     *
+     * @returns Future that becomes ready when move is finished
+     */
+    std::future<void> moveAsync(const pawnshop::vec::Vec3D newPos,
+                                const CancellationToken& cancel = {});
+    std::future<void> moveAsync(
+        const std::vector<pawnshop::vec::Vec3D>& waypoints,
+        const CancellationToken& cancel = {});
+    std::future<void> calibrateAsync(const CancellationToken& cancel = {});
+    /**
+     * @returns Future that becomes ready when everything scheduled before
+     * is finished
+     */
+    std::future<void> whenIdle();
     pawnshop::vec::Vec3D getPos();
+    /**
+     * @returns Statistics of step timing errors since startup
+     */
+    const JitterHistogram& getJitter() const;
 
 private:
+    // Declared first, since lines of axes and bus refer to it
+    std::shared_ptr<gpio::Backend> backend;
     std::array<std::unique_ptr<Axis>, 3> axes;
-    gpiod::chip chip;
+    std::vector<std::vector<size_t>> homing_order;
+    std::shared_ptr<StepBus> bus;
+    StepTimer timer;
+    // Set once homing finishes, only used by stepping thread
+    bool calibrated = false;
+
+    // All motion is executed by stepping thread in order of scheduling
+    std::unique_ptr<RealtimeConfig> realtime;
+    std::mutex tasks_mx;
+    std::condition_variable tasks_cv;
+    std::deque<std::packaged_task<void()>> tasks;
+    bool stopping = false;
+    std::thread stepper;
+
+    void setup(RailsConfig& conf);
+    std::future<void> schedule(std::function<void()> task);
+    void runTasks();
+    RailsKinematics getKinematics() const;
+    void followPath(const std::vector<pawnshop::vec::Vec3D>& waypoints,
+                    const CancellationToken& cancel);
+    /**
+     * @param braking: Speed along path once cancelled, carried over to the
+     * next segment
+     * @returns False if carriage stopped before the end of segment
+     */
+    bool executeSegment(const Segment& segment,
+                        const CancellationToken& cancel,
+                        std::optional<double>& braking);
+    /**
+     * Every step is made at the earliest deadline among homed axes, axes
+     * due at the same time are stepped with a single write
+     *
+     * @param position_known: Rails were homed since startup, see
+     * Axis::Homing
+     * @throws OperationCancelled once axes are stopped after cancel
+     */
+    void homeGroup(const std::vector<size_t>& group, bool position_known,
+                   const CancellationToken& cancel);
 };
 
 }  // namespace pawnshop
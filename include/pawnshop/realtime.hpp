@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <toml++/toml_table.hpp>
+
+namespace pawnshop {
+
+struct RealtimeConfig {
+    // SCHED_FIFO priority 1-99, 0 keeps default scheduling
+    int priority;
+    // CPU that thread is pinned to, preferably one isolated with isolcpus.
+    // Required with priority, since timer spins before every step and an
+    // unpinned SCHED_FIFO spinner starves other threads on its CPU.
+    std::optional<size_t> cpu;
+    // Locks all current and future memory of the process with mlockall
+    bool lock_memory;
+    // Bytes of stack touched in advance, so thread doesn't page fault later
+    size_t stack_prefault;
+
+    RealtimeConfig(const toml::table& table);
+};
+
+/**
+ * Applies settings to the calling thread. Settings that can't be applied,
+ * i.e. because of missing privileges, are skipped with a warning, so thread
+ * keeps running with default ones.
+ */
+void setupRealtime(const RealtimeConfig& conf);
+
+}  // namespace pawnshop
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace pawnshop {
+
+/**
+ * Ways to estimate weight from a window of samples
+ */
+enum class Estimator {
+    MEAN,
+    MEDIAN,
+    // Mean without a fraction of the lowest and the highest samples
+    TRIMMED_MEAN,
+    // Mean of samples within a few median absolute deviations of median
+    MAD,
+};
+
+/**
+ * @returns Estimator by its name in config
+ */
+Estimator parseEstimator(const std::string& name);
+
+struct StatEstimate {
+    double value;
+    // Standard error of value
+    double uncertainty;
+};
+
+/**
+ * Sliding window of values kept both in arrival order and sorted, so order
+ * statistics are read without sorting. Push costs a binary search and a
+ * move of part of the sorted buffer, nothing is allocated once the window
+ * is full.
+ */
+class SlidingWindow {
+public:
+    explicit SlidingWindow(const size_t capacity);
+
+    /**
+     * Adds value, dropping the oldest one if window is full
+     */
+    void push(const double value);
+    void clear();
+    size_t size() const;
+    bool full() const;
+
+    double median() const;
+    /**
+     * @returns Median absolute deviation from median
+     */
+    double mad() const;
+    /**
+     * @param trim: Fraction of values dropped from each end
+     */
+    double trimmedMean(const double trim) const;
+    /**
+     * @param trim: Used by TRIMMED_MEAN
+     * @param mad_threshold: Values further than that many standard
+     * deviations from median are dropped by MAD, where standard deviation
+     * is estimated as 1.4826 * MAD
+     */
+    StatEstimate estimate(const Estimator estimator, const double trim,
+                          const double mad_threshold) const;
+
+private:
+    const size_t capacity;
+    // Circular buffer in arrival order
+    std::vector<double> values;
+    size_t oldest = 0;
+    std::vector<double> sorted;
+
+    /**
+     * @returns Mean and its standard error over a range of sorted values
+     */
+    StatEstimate rangeEstimate(const size_t begin, const size_t end) const;
+};
+
+}  // namespace pawnshop
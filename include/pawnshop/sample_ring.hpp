@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace pawnshop {
+
+struct ScaleSample {
+    std::chrono::steady_clock::time_point time;
+    double weight;
+    bool stable;
+    bool container;
+};
+
+/**
+ * Last samples from scales, pushed by a single thread and read by any number
+ * of threads without locks. Sample overwritten while being read is reported
+ * as missing, so readers never see a torn one.
+ */
+class SampleRing {
+public:
+    static constexpr size_t CAPACITY = 1024;
+
+    SampleRing() = default;
+    SampleRing(const SampleRing&) = delete;
+    SampleRing& operator=(const SampleRing&) = delete;
+
+    void push(const ScaleSample& sample);
+    /**
+     * @returns Index the next sample gets, also amount of samples pushed
+     */
+    uint64_t end() const;
+    /**
+     * @returns Sample by index, {} if it's not pushed yet or overwritten
+     */
+    std::optional<ScaleSample> get(const uint64_t index) const;
+    /**
+     * @returns Last pushed sample, {} if there are none
+     */
+    std::optional<ScaleSample> latest() const;
+
+private:
+    // Fields are atomic, so concurrent reads of a slot being written are
+    // not a data race. Sequence is index + 1 of the sample in slot, 0 while
+    // slot is being written.
+    struct Slot {
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<std::chrono::steady_clock::rep> time{0};
+        std::atomic<double> weight{0};
+        std::atomic<bool> stable{false};
+        std::atomic<bool> container{false};
+    };
+    std::array<Slot, CAPACITY> slots;
+    std::atomic<uint64_t> head{0};
+};
+
+}  // namespace pawnshop
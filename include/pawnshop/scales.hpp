@@ -1,46 +1,142 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
-#include <fstream>
+#include <condition_variable>
+#include <functional>
 #include <future>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <toml++/toml_table.hpp>
 
+#include "sample_ring.hpp"
+#include "serial_port.hpp"
+#include "settling.hpp"
+#include "util.hpp"
+
 namespace pawnshop {
 
 struct ScalesConfig {
-    std::string uart_path;
-    size_t sample_size;
+    std::unique_ptr<SerialConfig> serial;
+    std::unique_ptr<SettlingConfig> settling;
 
     ScalesConfig(const toml::table& table);
 };
 
+/**
+ * Fields of a scales line, in the order they are sent
+ */
+enum class ScaleField { NONE, STABILITY, MODE, WEIGHT, UNIT, LENGTH };
+
+/**
+ * @returns Field name for log messages
+ */
+const char* toString(ScaleField field);
+
+/**
+ * Single line sent by scales, i.e. "ST,GS- 12.345 g "
+ */
+struct ScaleReading {
+    // Points into the parsed line
+    std::string_view unit;
+    double weight;
+    bool stable;
+    bool container;
+};
+
+struct ParsedLine {
+    ScaleReading reading;
+    // First field that does not match the format, NONE if line is valid
+    ScaleField error;
+};
+
+/**
+ * Reads scales continuously on its own thread, so samples that arrive
+ * between calls are kept and calls don't wait for the next line
+ */
 class Scales {
 public:
+    using SampleCallback = std::function<void(const ScaleSample&)>;
+
+    /**
+     * Keeps callback subscribed until destroyed
+     */
+    class Subscription {
+    public:
+        Subscription(Scales& scales, uint64_t id);
+        Subscription(Subscription&& other);
+        Subscription(const Subscription&) = delete;
+        Subscription& operator=(const Subscription&) = delete;
+        ~Subscription();
+
+    private:
+        Scales* scales;
+        uint64_t id;
+    };
+
     Scales(std::unique_ptr<const ScalesConfig> conf);
     ~Scales();
     /**
-     * Measures for n consecutive times with all measurements being stable,
-     * where n is defined in configuration file as "sample_size". In case
-     * unstable measurement met - starts over.
+     * Waits until weight settles, as defined by SettlingConfig. Samples
+     * received shortly before the call are used too.
      *
-     * @returns Either median of all measurements, or {} in case scales are
-     * turned off
+     * @param since: Samples older than that are not used, i.e. taken before
+     * object was put on scales
+     * @returns Estimate of weight, or {} in case scales are turned off or
+     * waiting is cancelled. On settling timeout it's the best estimate seen,
+     * marked as not settled.
+     */
+    std::optional<WeightEstimate> getWeight(
+        std::chrono::steady_clock::time_point since = {},
+        const CancellationToken& cancel = {});
+    /**
+     * @returns True right away if scales sent anything recently, otherwise
+     * waits for a line up to timeout
      */
-    std::optional<double> getWeight();
     bool poweredOn(
         std::chrono::duration<int> timeout = std::chrono::seconds(10));
+    /**
+     * @returns Last valid sample, {} if there are none yet
+     */
+    std::optional<ScaleSample> latest() const;
+    /**
+     * Calls back with every sample as soon as it's received. Callback runs
+     * on the reader thread, so it should return quickly and must not
+     * subscribe or unsubscribe.
+     */
+    [[nodiscard]] Subscription subscribe(SampleCallback callback);
+    /**
+     * Parses line without allocations, so it keeps up with any baud rate
+     */
+    static ParsedLine parse(std::string_view line);
 
 private:
+    // Scales are considered off when they are silent for that long
+    static constexpr std::chrono::seconds SILENCE_TIMEOUT{10};
+    // Scales send lines more often than that while powered on
+    static constexpr std::chrono::seconds LINE_INTERVAL{1};
+    static constexpr std::chrono::seconds RECONNECT_INTERVAL{5};
+    static constexpr std::chrono::milliseconds READ_TIMEOUT{100};
+
     std::unique_ptr<const ScalesConfig> conf;
-    struct State {
-        std::string unit;
-        double weight;
-        bool stable;
-        bool container;
-    };
-    std::optional<State> parse(const std::string line);
+    // Used by reader thread only
+    SerialPort port;
+    SampleRing samples;
+    // Notified on every line, guards last_line
+    std::mutex line_mx;
+    std::condition_variable line_cv;
+    std::chrono::steady_clock::time_point last_line;
+    std::mutex subscribers_mx;
+    std::map<uint64_t, SampleCallback> subscribers;
+    uint64_t next_subscriber = 0;
+    std::atomic<bool> running{true};
+    std::thread reader;
+
+    void readSamples();
 };
 
 }  // namespace pawnshop
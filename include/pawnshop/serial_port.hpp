@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <toml++/toml_table.hpp>
+
+#include "util.hpp"
+
+namespace pawnshop {
+
+struct SerialConfig {
+    std::string path;
+    uint32_t baud_rate;
+    // "none", "even" or "odd"
+    std::string parity;
+    // Minimal amount of bytes returned by read
+    uint8_t vmin;
+    // Read timeout after the last byte, tenths of a second
+    uint8_t vtime;
+
+    SerialConfig(const toml::table& table);
+};
+
+/**
+ * UART in raw mode, opened once and reopened when the device goes away,
+ * i.e. USB adapter is replugged
+ */
+class SerialPort {
+public:
+    explicit SerialPort(const SerialConfig& conf);
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+    ~SerialPort();
+    /**
+     * Reopens port if it's closed or device is lost
+     *
+     * @returns False if device is not available
+     */
+    bool connect();
+    /**
+     * @returns Next line received, {} on timeout or if device is lost
+     */
+    std::optional<std::string> readLine(std::chrono::milliseconds timeout);
+
+private:
+    const SerialConfig conf;
+    int fd = -1;
+    std::optional<LineReader> reader;
+
+    bool open();
+    void close();
+    bool lost() const;
+};
+
+}  // namespace pawnshop
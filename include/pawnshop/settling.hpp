@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <toml++/toml_table.hpp>
+
+#include "robust_stats.hpp"
+#include "sample_ring.hpp"
+
+namespace pawnshop {
+
+struct SettlingConfig {
+    // Amount of last samples the weight is estimated from
+    size_t window;
+    Estimator estimator;
+    // Fraction of samples dropped from each end by trimmed mean
+    double trim;
+    // Samples further from median than that many standard deviations are
+    // dropped by MAD estimator
+    double mad_threshold;
+    // Largest accepted standard error of the estimate
+    double tolerance;
+    // Largest accepted change of weight over the window, from linear fit
+    double max_drift;
+    // Window must have no samples scales marked as unstable
+    bool use_stable_flag;
+    // Best estimate is returned after that even if scales didn't settle
+    std::chrono::seconds timeout;
+
+    SettlingConfig(const toml::table& table);
+};
+
+struct WeightEstimate {
+    double weight;
+    // Standard error of weight
+    double uncertainty;
+    // Weight change over the window
+    double drift;
+    // False when estimate doesn't meet settling criteria
+    bool settled;
+};
+
+/**
+ * Decides when weight has settled from a sliding window of samples. Adding
+ * a sample only updates running sums, the estimator runs when an estimate
+ * is asked for.
+ */
+class SettlingDetector {
+public:
+    explicit SettlingDetector(const SettlingConfig& conf);
+
+    void add(const ScaleSample& sample);
+    /**
+     * @returns Estimate over the current window, {} until it's full
+     */
+    std::optional<WeightEstimate> estimate();
+    /**
+     * @returns Estimate with the lowest uncertainty out of the current
+     * window and the ones estimate() was asked for, for when scales don't
+     * settle in time. {} if there were no samples.
+     */
+    std::optional<WeightEstimate> best();
+
+private:
+    const SettlingConfig& conf;
+    std::deque<ScaleSample> window;
+    SlidingWindow weights;
+    size_t unstable = 0;
+    // Sums for drift fit, relative to the first sample to keep precision
+    std::chrono::steady_clock::time_point origin_time;
+    double origin_weight = 0;
+    double sum_t = 0, sum_w = 0, sum_tt = 0, sum_tw = 0;
+    // Estimate of the current window, once computed
+    std::optional<WeightEstimate> current;
+    std::optional<WeightEstimate> best_estimate;
+    bool best_full = false;
+
+    void update(const ScaleSample& sample, bool added);
+    const WeightEstimate& compute();
+};
+
+}  // namespace pawnshop
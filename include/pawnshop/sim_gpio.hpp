@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "gpio.hpp"
+#include "rails.hpp"
+
+namespace pawnshop {
+namespace gpio {
+
+struct SimulatedAxis {
+    size_t clock_pin;
+    size_t direction_pin;
+    // Active low, like real switches
+    size_t limit_pin;
+    // Motor turns in negative direction on high direction level
+    bool inverted;
+    // Travel in steps, carriage stalls at both ends
+    int64_t steps;
+    // Carriage position at startup, steps from the limit switch
+    int64_t position = 0;
+    // Steps carriage can travel past the switch, it stalls there
+    int64_t overtravel = 0;
+};
+
+/**
+ * Rails without hardware. Counts steps of every axis on rising clock edges,
+ * holds limit switch pressed while carriage is at position 0 or past it and
+ * records every edge with the time it was written.
+ */
+class SimulatedBackend : public Backend {
+public:
+    struct Edge {
+        std::chrono::steady_clock::time_point time;
+        size_t pin;
+        bool high;
+    };
+
+    explicit SimulatedBackend(std::vector<SimulatedAxis> axes);
+    /**
+     * Models axes described in config, carriage starts at limit switches
+     */
+    explicit SimulatedBackend(const RailsConfig& conf);
+
+    std::unique_ptr<Outputs> requestOutputs(
+        const std::vector<size_t>& pins, const std::string& consumer) override;
+    std::unique_ptr<Input> requestInput(const size_t pin,
+                                        const std::string& consumer) override;
+
+    /**
+     * @returns Actual carriage position of axis in steps
+     */
+    int64_t getPosition(const size_t axis) const;
+    /**
+     * Moves carriage by hand, i.e. before homing
+     */
+    void setPosition(const size_t axis, const int64_t steps);
+    /**
+     * @returns Steps made against the ends of axis, which real carriage
+     * would miss
+     */
+    uint64_t getStalls(const size_t axis) const;
+    /**
+     * Edge recording is on by default, long moves take 24 bytes per edge
+     */
+    void setRecording(const bool enabled);
+    /**
+     * @returns Edges recorded since the last call
+     */
+    std::vector<Edge> takeEdges();
+
+private:
+    friend class SimulatedOutputs;
+    friend class SimulatedInput;
+
+    struct AxisState {
+        SimulatedAxis conf;
+        uint64_t stalls = 0;
+    };
+
+    mutable std::mutex mx;
+    std::vector<AxisState> axes;
+    std::unordered_map<size_t, int> levels;
+    std::unordered_map<size_t, size_t> clock_axes;
+    bool recording = true;
+    std::vector<Edge> edges;
+
+    void write(const std::vector<size_t>& pins,
+               const std::vector<int>& values);
+    int read(const size_t pin) const;
+    void step(AxisState& axis);
+};
+
+}  // namespace gpio
+}  // namespace pawnshop
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gpio.hpp"
+
+namespace pawnshop {
+
+/**
+ * Clock and direction lines of all motors requested as two groups.
+ * Edges of motors stepping on the same tick are written with a single
+ * request, direction changes are written together before the next rising
+ * edge and held for setup time of drivers before it.
+ */
+class StepBus {
+public:
+    // Bit per motor channel
+    using Mask = uint32_t;
+
+    /**
+     * @param dir_setup: Time drivers need between direction change and
+     * rising clock edge
+     */
+    StepBus(gpio::Backend& backend, const std::vector<size_t>& clock_pins,
+            const std::vector<size_t>& dir_pins,
+            const std::chrono::nanoseconds dir_setup = {});
+    StepBus(const StepBus&) = delete;
+    StepBus& operator=(const StepBus&) = delete;
+
+    /**
+     * Sets clock lines of all channels in mask. Pending direction changes are
+     * written before a rising edge, which then waits out the setup time.
+     * Falling edges leave them pending.
+     */
+    void setClocks(const Mask channels, const bool high);
+    /**
+     * Direction is written together with other pending changes right before
+     * the next rising clock edge
+     */
+    void setDirection(const size_t channel, const bool high);
+    size_t size() const;
+
+private:
+    std::unique_ptr<gpio::Outputs> clock_lines, dir_lines;
+    std::vector<int> clock_values, dir_values;
+    bool dir_pending = false;
+    std::chrono::nanoseconds dir_setup;
+};
+
+}  // namespace pawnshop
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace pawnshop {
+
+/**
+ * Histogram of differences between achieved and commanded step intervals.
+ * Safe to query from other threads while steps are being recorded.
+ */
+class JitterHistogram {
+public:
+    static constexpr std::chrono::nanoseconds BUCKET_WIDTH{100};
+    static constexpr size_t BUCKET_COUNT = 1000;
+
+    JitterHistogram() = default;
+    JitterHistogram(const JitterHistogram&) = delete;
+    JitterHistogram& operator=(const JitterHistogram&) = delete;
+
+    void record(const std::chrono::nanoseconds error);
+    /**
+     * Counts a deadline missed by more than the interval leading to it
+     */
+    void recordOverrun();
+    void reset();
+    uint64_t count() const;
+    uint64_t overruns() const;
+    /**
+     * @param q: Quantile in range [0, 1]
+     * @returns Upper bound of absolute error for given quantile of steps,
+     * errors beyond histogram range are reported as the largest one seen
+     */
+    std::chrono::nanoseconds percentile(const double q) const;
+    std::chrono::nanoseconds max() const;
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> buckets{};
+    std::atomic<uint64_t> overflow{0};
+    std::atomic<int64_t> max_error{0};
+    std::atomic<uint64_t> overrun_count{0};
+};
+
+/**
+ * Waits for absolute deadlines on a single timeline, so time lost to
+ * scheduling doesn't accumulate from step to step. Sleeps with
+ * clock_nanosleep and spins for the last few microseconds, where spin
+ * threshold is calibrated from measured wake-up latency. When a deadline is
+ * missed by more than its interval, timeline is moved to current moment
+ * instead of catching up with a burst of steps.
+ */
+class StepTimer {
+public:
+    StepTimer();
+    StepTimer(const StepTimer&) = delete;
+    StepTimer& operator=(const StepTimer&) = delete;
+
+    /**
+     * Measures wake-up latency to set spin threshold, should be called from
+     * the thread that steps, after its scheduling is set up
+     */
+    void calibrate();
+    /**
+     * Starts new timeline from current moment
+     */
+    void start();
+    /**
+     * Advances deadline by interval and waits until it's reached, overruns
+     * are counted in jitter histogram
+     */
+    void sleep(const std::chrono::nanoseconds interval);
+    /**
+     * Records interval error for a step made at current deadline, should be
+     * called right after step signal is raised
+     */
+    void recordStep();
+    const JitterHistogram& jitter() const;
+    std::chrono::nanoseconds spinThreshold() const;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Spins long before calibration, it's precise but wastes CPU
+    std::chrono::nanoseconds spin_threshold = std::chrono::microseconds{500};
+    clock::time_point deadline;
+    bool has_prev_step = false;
+    clock::time_point prev_step_deadline;
+    clock::time_point prev_step_time;
+    JitterHistogram histogram;
+
+    void sleepUntil(const clock::time_point time) const;
+};
+
+}  // namespace pawnshop
@@ -1,11 +1,115 @@
 #pragma once
+#include <atomic>
 #include <chrono>
-#include <istream>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <stdexcept>
+#include <string>
 
 namespace pawnshop {
 
-std::optional<std::string> getline_timeout(std::istream &is,
-                                           std::chrono::duration<int> timeout);
+/**
+ * Splits bytes coming from a descriptor into lines. Waits for data with
+ * poll, so no thread is blocked in read and timeout is exact. Bytes after
+ * the returned line are kept for the next call.
+ */
+class LineReader {
+public:
+    explicit LineReader(int fd);
+    /**
+     * @returns Line without "\n" or "\r\n", {} on timeout or when
+     * descriptor fails
+     */
+    std::optional<std::string> getline(std::chrono::milliseconds timeout);
+    /**
+     * @returns True if descriptor was closed or returned an error
+     */
+    bool failed() const;
 
-}
+private:
+    static constexpr size_t MAX_LINE = 4096;
+
+    int fd;
+    bool error = false;
+    std::string buffer;
+    // Part of buffer already searched for "\n"
+    size_t scanned = 0;
+
+    std::optional<std::string> takeLine();
+};
+
+/**
+ * Thrown by operations stopped with CancellationToken
+ */
+class OperationCancelled : public std::runtime_error {
+public:
+    OperationCancelled();
+};
+
+/**
+ * Asks long running operations to stop early. Copies share the same flag, so
+ * a copy is handed to every operation that should be stopped together. Once
+ * cancelled, token stays cancelled.
+ */
+class CancellationToken {
+    struct State;
+
+public:
+    /**
+     * Keeps callback registered until destroyed
+     */
+    class Registration {
+    public:
+        Registration() = default;
+        Registration(std::shared_ptr<State> state, uint64_t id);
+        Registration(Registration&& other);
+        Registration(const Registration&) = delete;
+        Registration& operator=(const Registration&) = delete;
+        ~Registration();
+
+    private:
+        std::shared_ptr<State> state;
+        uint64_t id = 0;
+    };
+
+    CancellationToken();
+    void cancel() const;
+    /**
+     * Lock free, so it can be checked on every step
+     */
+    bool cancelled() const;
+    /**
+     * @throws OperationCancelled if cancelled
+     */
+    void throwIfCancelled() const;
+    /**
+     * Sleeps for given time or until token is cancelled
+     *
+     * @returns True if cancelled
+     */
+    bool sleepFor(std::chrono::nanoseconds time) const;
+    /**
+     * Calls back once token is cancelled, right away if it already is. Used
+     * to wake up waits on other condition variables. Callback runs on the
+     * cancelling thread under token lock, so it should return quickly and
+     * must not register or unregister.
+     */
+    [[nodiscard]] Registration onCancel(std::function<void()> callback) const;
+
+private:
+    struct State {
+        std::atomic<bool> cancelled{false};
+        std::mutex mx;
+        std::condition_variable cv;
+        std::map<uint64_t, std::function<void()>> callbacks;
+        uint64_t next_callback = 1;
+    };
+    std::shared_ptr<State> state;
+};
+
+}  // namespace pawnshop
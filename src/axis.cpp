@@ -1,10 +1,14 @@
 #include "pawnshop/axis.hpp"
 
+#include <doctest/doctest.h>
+#include <toml++/toml.h>
+
+#include <chrono>
 #include <cmath>
-#include <functional>
-#include <iostream>
 #include <memory>
-#include <thread>
+#include <stdexcept>
+
+#include "pawnshop/sim_gpio.hpp"
 
 using namespace std;
 using namespace std::chrono_literals;
@@ -17,31 +21,78 @@ AxisConfig::AxisConfig(const toml::table &table) {
     min_speed = table["min_speed"].value<double>().value();
     max_speed = table["max_speed"].value<double>().value();
     acceleration = table["acceleration"].value<double>().value();
+    jerk = table["jerk"].value_or(0.0);
+    homing_overtravel = table["homing"]["overtravel"].value_or(0.0);
+    // Fastest speed that still stops within overtravel by default
+    const ProfileLimits limits{min_speed, max_speed, acceleration, jerk};
+    homing_fast_speed = table["homing"]["fast_speed"].value_or(
+        reachableSpeed(min_speed, homing_overtravel, limits));
+    if (rampDistance(homing_fast_speed, min_speed, limits) >
+        homing_overtravel) {
+        throw invalid_argument("Homing fast_speed " +
+                               to_string(homing_fast_speed) +
+                               " doesn't stop within overtravel " +
+                               to_string(homing_overtravel));
+    }
+    homing_slow_speed =
+        table["homing"]["slow_speed"].value_or(min_speed / 2);
+    // Carriage stops dead at the switch
+    if (homing_slow_speed > min_speed) {
+        throw invalid_argument("Homing slow_speed " +
+                               to_string(homing_slow_speed) +
+                               " exceeds min_speed " + to_string(min_speed));
+    }
+    homing_backoff = table["homing"]["backoff"].value_or(5.0);
 
     motor = make_unique<MotorConfig>(*table["motor"].as_table());
     negative = make_unique<LimitSwitchConfig>(
         *table["limit_switches"]["negative"].as_table());
 }
 
+AxisConfig::AxisConfig(const AxisConfig &other)
+    : length(other.length),
+      steps(other.steps),
+      min_speed(other.min_speed),
+      max_speed(other.max_speed),
+      acceleration(other.acceleration),
+      jerk(other.jerk),
+      homing_fast_speed(other.homing_fast_speed),
+      homing_slow_speed(other.homing_slow_speed),
+      homing_backoff(other.homing_backoff),
+      homing_overtravel(other.homing_overtravel),
+      motor(make_unique<MotorConfig>(*other.motor)),
+      negative(make_unique<LimitSwitchConfig>(*other.negative)) {}
+
 Axis::Axis(const double axis_length, const uint32_t step_count,
            const double min_speed, const double max_speed,
-           const double acceleration, Motor &&motor, LimitSwitch &&negative)
+           const double acceleration, const double jerk,
+           const double homing_fast_speed, const double homing_slow_speed,
+           const double homing_backoff, Motor &&motor, LimitSwitch &&negative)
     : motor(std::move(motor)),
       negative(std::move(negative)),
       axis_length(axis_length),
       step_length(axis_length / step_count),
       MIN_SPEED(min_speed),
       MAX_SPEED(max_speed),
-      ACCELERATION(acceleration) {}
+      ACCELERATION(acceleration),
+      JERK(jerk),
+      HOMING_FAST_SPEED(homing_fast_speed),
+      HOMING_SLOW_SPEED(homing_slow_speed),
+      HOMING_BACKOFF(homing_backoff) {}
 
-Axis::Axis(gpiod::chip chip, const unique_ptr<AxisConfig> conf)
+Axis::Axis(gpio::Backend &backend, shared_ptr<StepBus> bus,
+           const size_t channel, const unique_ptr<AxisConfig> conf)
     : Axis{conf->length,
            conf->steps,
            conf->min_speed,
            conf->max_speed,
            conf->acceleration,
-           Motor{chip, std::move(conf->motor)},
-           LimitSwitch{chip, std::move(conf->negative)}} {}
+           conf->jerk,
+           conf->homing_fast_speed,
+           conf->homing_slow_speed,
+           conf->homing_backoff,
+           Motor{std::move(bus), channel, std::move(conf->motor)},
+           LimitSwitch{backend, std::move(conf->negative)}} {}
 
 Axis::Axis(Axis &&src)
     : motor(std::move(src.motor)),
@@ -50,89 +101,250 @@ Axis::Axis(Axis &&src)
       step_length(src.step_length),
       MIN_SPEED(src.MIN_SPEED),
       MAX_SPEED(src.MAX_SPEED),
-      ACCELERATION(src.ACCELERATION) {}
+      ACCELERATION(src.ACCELERATION),
+      JERK(src.JERK),
+      HOMING_FAST_SPEED(src.HOMING_FAST_SPEED),
+      HOMING_SLOW_SPEED(src.HOMING_SLOW_SPEED),
+      HOMING_BACKOFF(src.HOMING_BACKOFF),
+      position(src.position.load()) {}
 
-void Axis::calibrate() {
+Axis::Homing::Homing(Axis &axis, const bool position_known)
+    : axis(axis) {
     // TODO: Calibration for case with 2 limit switches
-    setSpeed(-MIN_SPEED);
-    while (negative.has_value() && !negative.value()) motor.step();
-    setPosition(0.0);
+    if (!axis.negative.has_value()) {
+        startPhase(DONE);
+    } else {
+        startPhase(position_known ? RAPID : FAST);
+    }
 }
 
-void Axis::move(const double new_pos, const double scaling) {
-    const double old_pos = getPosition();
-    const double S = std::abs(new_pos - old_pos);
-    const int8_t dir = (new_pos - old_pos > 0) ? 1 : -1;
-    const double a = ACCELERATION * scaling;  // mm per s^2
-    const double v_0 = MIN_SPEED * scaling;
-    const double v_max = MAX_SPEED * scaling;
-    // Assume target is far enough to accelerate to full speed
-    const double t_accel = (v_max - v_0) / a;
-    double S_accel = std::abs(v_0 * t_accel + a * std::pow(t_accel, 2) / 2);
-    // Target isn't far enough
-    if (S_accel > S / 2) {
-        // Accelerate for only half of distance
-        S_accel = S / 2;
-    }
-    setSpeed(v_0);
-    std::thread stepping(&Axis::step, this,
-                         static_cast<uint32_t>(std::ceil(S / step_length)));
-    const auto dt = 1ms;
-    const double dv = a * dt.count() / (1000ms).count();
-    // Acceleration
-    while (dir * (getPosition() - old_pos) < S_accel &&
-           dir * (v_max - getSpeed()) > 0) {
-        setSpeed(getSpeed() + dv);
-        std::this_thread::sleep_for(dt);
-    }
-    // Constant speed
-    while (dir * (new_pos - getPosition()) > S_accel) {
-        std::this_thread::sleep_for(dt);
+void Axis::Homing::startPhase(const Phase next) {
+    phase = next;
+    step = 0;
+    const double step_length = axis.step_length;
+    const auto backoff_steps =
+        static_cast<uint64_t>(std::ceil(axis.HOMING_BACKOFF / step_length));
+    const ProfileLimits rapid = axis.getLimits();
+    const ProfileLimits fast{axis.MIN_SPEED, axis.HOMING_FAST_SPEED,
+                             axis.ACCELERATION, axis.JERK};
+    const ProfileLimits slow{axis.HOMING_SLOW_SPEED, axis.HOMING_SLOW_SPEED,
+                             axis.ACCELERATION};
+    switch (phase) {
+        case RAPID: {
+            // Ends at fast_speed backoff short of the switch, so some drift
+            // of position still leaves room to ramp down
+            const int64_t steps = axis.position.load(memory_order_relaxed) -
+                                  static_cast<int64_t>(backoff_steps);
+            if (steps <= 0) {
+                startPhase(FAST);
+                return;
+            }
+            axis.motor.setDirection(Motor::NEGATIVE);
+            profile.emplace(steps, step_length, rapid, 0,
+                            axis.HOMING_FAST_SPEED);
+            break;
+        }
+        case FAST: {
+            // Speed stays up until the switch trips, it ramps down at the
+            // end of travel only
+            const auto travel_steps = static_cast<uint64_t>(
+                std::ceil(axis.axis_length / step_length));
+            axis.motor.setDirection(Motor::NEGATIVE);
+            profile.emplace(travel_steps + backoff_steps, step_length, fast,
+                            currentSpeed());
+            break;
+        }
+        case BRAKE: {
+            // Switch trips at fast_speed at most, which ramps down within
+            // overtravel
+            const double speed = currentSpeed();
+            overshoot = static_cast<uint64_t>(std::ceil(
+                rampDistance(speed, axis.MIN_SPEED, rapid) / step_length));
+            profile.emplace(overshoot, step_length, rapid, speed);
+            break;
+        }
+        case BACKOFF:
+            axis.motor.setDirection(Motor::POSITIVE);
+            profile.emplace(overshoot + backoff_steps, step_length, fast);
+            break;
+        case SLOW:
+            // Precision comes from slow approach, which starts close to the
+            // switch
+            axis.motor.setDirection(Motor::NEGATIVE);
+            profile.emplace(2 * backoff_steps, step_length, slow);
+            break;
+        case DONE:
+            profile.reset();
+            axis.setPosition(0.0);
+            break;
     }
-    // Deceleration
-    while (dir * (new_pos - getPosition()) > 0 &&
-           dir * (getSpeed() - v_0) > 0) {
-        setSpeed(getSpeed() - dv);
-        std::this_thread::sleep_for(dt);
+}
+
+double Axis::Homing::currentSpeed() const {
+    return last > 0ns ? axis.step_length /
+                            chrono::duration<double>(last).count()
+                      : 0;
+}
+
+optional<chrono::nanoseconds> Axis::Homing::next() {
+    while (phase != DONE) {
+        const bool approaching =
+            phase == RAPID || phase == FAST || phase == SLOW;
+        if (approaching && axis.negative.value()) {
+            startPhase(phase == SLOW ? DONE : BRAKE);
+            continue;
+        }
+        if (step < profile->size()) {
+            last = profile->interval(step++);
+            return last;
+        }
+        switch (phase) {
+            case RAPID:
+                startPhase(FAST);
+                break;
+            case BRAKE:
+                startPhase(BACKOFF);
+                break;
+            case BACKOFF:
+                startPhase(SLOW);
+                break;
+            default:
+                throw runtime_error("Limit switch not reached while homing");
+        }
     }
-    stepping.join();
+    return {};
 }
 
-double Axis::getPosition() {
-    std::shared_lock lck(position_mx);
-    return position;
+int64_t Axis::stepsTo(const double new_pos) const {
+    return std::llround(new_pos / step_length) -
+           position.load(memory_order_relaxed);
 }
 
-void Axis::setPosition(const double new_pos) {
-    std::unique_lock lck(position_mx);
-    position = new_pos;
+double Axis::getStepLength() const { return step_length; }
+
+ProfileLimits Axis::getLimits() const {
+    return {MIN_SPEED, MAX_SPEED, ACCELERATION, JERK};
 }
 
-void Axis::incPosition(const double inc) {
-    std::unique_lock lck(position_mx);
-    position += inc;
+void Axis::setDirection(const Motor::Direction dir) {
+    motor.setDirection(dir);
 }
 
-void Axis::step(uint32_t steps) {
-    for (uint32_t i = 0; i < steps; i++) {
-        // Stop when limit switch reached
-        if (motor.getDirection() == Motor::NEGATIVE && negative.has_value() &&
-            negative.value()) {
-            break;
-        }
-        motor.step();
-        incPosition(step_length * motor.getDirection());
+bool Axis::advance() {
+    // Stop when limit switch reached
+    if (motor.getDirection() == Motor::NEGATIVE && negative.has_value() &&
+        negative.value()) {
+        return false;
     }
+    incPosition(motor.getDirection());
+    return true;
+}
+
+StepBus::Mask Axis::getClockMask() const { return motor.getClockMask(); }
+
+double Axis::getPosition() const {
+    return position.load(memory_order_relaxed) * step_length;
 }
 
-void Axis::setSpeed(double speed) {
-    motor.setFrequency(std::abs(speed) / step_length);
-    motor.setDirection(speed > 0 ? Motor::POSITIVE : Motor::NEGATIVE);
+void Axis::setPosition(const double new_pos) {
+    position.store(std::llround(new_pos / step_length), memory_order_relaxed);
+}
+
+void Axis::incPosition(const int64_t steps) {
+    position.fetch_add(steps, memory_order_relaxed);
 }
 
-double Axis::getSpeed() const {
-    double scalar = motor.getFrequency() * step_length;
-    return scalar * static_cast<int8_t>(motor.getDirection());
+TEST_CASE("Axis::Homing") {
+    // Appended keys go to [homing] table
+    const string conf = R"(
+        length = 100.0
+        steps = 10000
+        min_speed = 10.0
+        max_speed = 100.0
+        acceleration = 1000.0
+        [motor]
+        clock_pin = 1
+        direction_pin = 2
+        counter_clockwise = false
+        [limit_switches.negative]
+        pin = 3
+        [homing]
+        backoff = 1.0
+    )";
+    // Carriage starts 50mm from the switch and can go 5mm past it
+    gpio::SimulatedBackend sim({{1, 2, 3, false, 10000, 5000, 500}});
+    auto bus =
+        make_shared<StepBus>(sim, vector<size_t>{1}, vector<size_t>{2});
+
+    struct Run {
+        chrono::nanoseconds time{0};
+        chrono::nanoseconds fastest = chrono::nanoseconds::max();
+        // Interval before the step that reaches the switch at last sets
+        // the speed carriage hits it with
+        chrono::nanoseconds at_switch{0};
+        int64_t furthest = 0;
+    };
+    const auto home = [&](Axis &axis, const bool position_known) {
+        Run run;
+        Axis::Homing homing(axis, position_known);
+        chrono::nanoseconds previous{0};
+        while (const auto interval = homing.next()) {
+            bus->setClocks(axis.getClockMask(), true);
+            bus->setClocks(axis.getClockMask(), false);
+            if (sim.getPosition(0) == 0) {
+                run.at_switch = previous;
+            }
+            run.furthest = std::min(run.furthest, sim.getPosition(0));
+            run.time += *interval;
+            run.fastest = std::min(run.fastest, *interval);
+            previous = *interval;
+        }
+        return run;
+    };
+
+    SUBCASE("Ramps down past the switch, stops at it slowly") {
+        Axis axis(sim, bus, 0,
+                  make_unique<AxisConfig>(
+                      toml::parse(conf + "overtravel = 5.0\n")));
+        const auto run = home(axis, false);
+        CHECK(sim.getPosition(0) == 0);
+        CHECK(sim.getStalls(0) == 0);
+        CHECK(axis.getPosition() == 0);
+        // Fast speed defaults to max_speed, which stops in 4.95mm
+        CHECK(run.fastest < 101us);
+        CHECK(run.furthest < -400);
+        // 0.01mm step at slow_speed
+        CHECK(run.at_switch >= 1999us);
+        // Crawling at min_speed takes 5s
+        CHECK(run.time < 2s);
+    }
+    SUBCASE("Rushes to known position") {
+        // Fast speed stopping within 1mm is about 46mm/s
+        Axis axis(sim, bus, 0,
+                  make_unique<AxisConfig>(
+                      toml::parse(conf + "overtravel = 1.0\n")));
+        const auto unknown = home(axis, false);
+        axis.setDirection(Motor::POSITIVE);
+        for (size_t i = 0; i < 5000; i++) {
+            REQUIRE(axis.advance());
+            bus->setClocks(axis.getClockMask(), true);
+            bus->setClocks(axis.getClockMask(), false);
+        }
+        REQUIRE(sim.getPosition(0) == 5000);
+        const auto known = home(axis, true);
+        CHECK(sim.getPosition(0) == 0);
+        CHECK(sim.getStalls(0) == 0);
+        CHECK(known.fastest < 101us);
+        CHECK(known.time < unknown.time * 3 / 4);
+    }
+    SUBCASE("Rejects speeds it can't stop from") {
+        CHECK_THROWS_AS(
+            AxisConfig{toml::parse(conf + "overtravel = 1.0\n"
+                                          "fast_speed = 50.0\n")},
+            invalid_argument);
+        CHECK_THROWS_AS(AxisConfig{toml::parse(conf + "slow_speed = 20.0\n")},
+                        invalid_argument);
+    }
 }
 
 }  // namespace pawnshop
@@ -0,0 +1,202 @@
+/**
+ * Measures how fast the motion stack pushes steps and how much timing error
+ * it adds, without hardware. Rails and devices are taken from
+ * ./dist/config.toml, so run it from the repository root.
+ */
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <time.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "pawnshop/config.hpp"
+#include "pawnshop/gpio.hpp"
+#include "pawnshop/path_planner.hpp"
+#include "pawnshop/rails.hpp"
+#include "pawnshop/sim_gpio.hpp"
+#include "pawnshop/step_bus.hpp"
+#include "pawnshop/step_timer.hpp"
+#include "pawnshop/vec.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace pawnshop;
+using namespace pawnshop::vec;
+
+/**
+ * Lines that go nowhere, so only the cost of the stack itself is measured
+ */
+class NullBackend : public gpio::Backend {
+    class NullOutputs : public gpio::Outputs {
+    public:
+        void setValues(const vector<int>&) override {}
+    };
+    class NullInput : public gpio::Input {
+    public:
+        // Limit switches are active low, so they are never pressed
+        int getValue() const override { return 1; }
+    };
+
+public:
+    unique_ptr<gpio::Outputs> requestOutputs(const vector<size_t>&,
+                                             const string&) override {
+        return make_unique<NullOutputs>();
+    }
+    unique_ptr<gpio::Input> requestInput(const size_t,
+                                         const string&) override {
+        return make_unique<NullInput>();
+    }
+};
+
+/**
+ * @returns CPU time used by all threads of the process
+ */
+nanoseconds cpuTime() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return seconds(ts.tv_sec) + nanoseconds(ts.tv_nsec);
+}
+
+struct Timing {
+    nanoseconds wall;
+    nanoseconds cpu;
+};
+
+template <typename F>
+Timing measure(F&& f) {
+    const auto wall_start = steady_clock::now();
+    const auto cpu_start = cpuTime();
+    f();
+    return {steady_clock::now() - wall_start, cpuTime() - cpu_start};
+}
+
+double toMs(const nanoseconds time) {
+    return duration<double, milli>(time).count();
+}
+
+double toUs(const nanoseconds time) {
+    return duration<double, micro>(time).count();
+}
+
+struct SimulatedRails {
+    shared_ptr<gpio::SimulatedBackend> backend;
+    unique_ptr<Rails> rails;
+};
+
+/**
+ * Every run gets new rails, so jitter statistics are not mixed. Stepping
+ * thread gets [realtime] settings, same as in controller.
+ */
+SimulatedRails makeRails() {
+    Config config;
+    auto sim = make_shared<gpio::SimulatedBackend>(*config.rails);
+    sim->setRecording(false);
+    auto rails = make_unique<Rails>(std::move(config.rails), sim,
+                                    std::move(config.realtime));
+    // Moves need homed rails. Switches are pressed at simulated position 0,
+    // so it's a few hundred slow steps, which count in jitter as well.
+    rails->calibrate();
+    return {sim, std::move(rails)};
+}
+
+void printJitter(const JitterHistogram& jitter) {
+    fmt::print("  jitter p50 {:.1f}us, p99 {:.1f}us, p99.9 {:.1f}us, "
+               "max {:.1f}us, {} overruns\n",
+               toUs(jitter.percentile(0.5)), toUs(jitter.percentile(0.99)),
+               toUs(jitter.percentile(0.999)), toUs(jitter.max()),
+               jitter.overruns());
+}
+
+/**
+ * Steps a single motor back to back the way stepping thread of rails does,
+ * which gives the upper bound of step rate
+ */
+void benchStepOverhead() {
+    const size_t steps = 200000;
+    NullBackend backend;
+    StepBus bus(backend, {0, 1, 2}, {3, 4, 5});
+    StepTimer timer;
+    timer.calibrate();
+    timer.start();
+    const auto m = measure([&]() {
+        for (size_t i = 0; i < steps; i++) {
+            bus.setClocks(1, true);
+            timer.recordStep();
+            timer.sleep(nanoseconds(0));
+            bus.setClocks(1, false);
+            timer.sleep(nanoseconds(0));
+        }
+    });
+    fmt::print("StepBus steps with zero period\n");
+    fmt::print("  {} steps in {:.1f}ms, {:.0f} steps/s, {:.2f}us CPU/step\n",
+               steps, toMs(m.wall), steps / duration<double>(m.wall).count(),
+               toUs(m.cpu) / steps);
+}
+
+/**
+ * Moves every axis alone over most of its length at configured limits
+ */
+void benchAxes() {
+    const char* names[] = {"X", "Y", "Z"};
+    Config config;
+    for (size_t i = 0; i < 3; i++) {
+        const auto& axis = config.rails->axes[i];
+        Vec3D target{0, 0, 0};
+        target[i] = axis->length * 0.9;
+        const auto simulated = makeRails();
+        const auto m = measure([&]() { simulated.rails->move(target); });
+        const int64_t steps = simulated.backend->getPosition(i);
+        fmt::print("{} axis, {:.1f}mm in {} steps\n", names[i], target[i],
+                   steps);
+        fmt::print("  {:.1f}ms, {:.0f} steps/s average, CPU {:.1f}%\n",
+                   toMs(m.wall), steps / duration<double>(m.wall).count(),
+                   100.0 * m.cpu.count() / m.wall.count());
+        printJitter(simulated.rails->getJitter());
+    }
+}
+
+/**
+ * Moves between devices in order of measurement routine, along the same
+ * paths as controller
+ */
+void benchDeviceMoves() {
+    Config config;
+    const auto& dev = config.devices;
+    const PathPlanner planner(dev->boundingBoxes(), dev->safe_height);
+    const vector<pair<string, Vec3D>> stops{
+        {"gold reciever", planner.above(dev->gold_reciever->coordinate)},
+        {"ultrasonic bath", dev->ultrasonic_bath->coordinate},
+        {"dryer", dev->dryer->coordinate},
+        {"scales", dev->scales->coordinate},
+        {"cup", dev->scales->cup->coordinate},
+        {"gold reciever", planner.above(dev->gold_reciever->coordinate)},
+    };
+
+    const auto simulated = makeRails();
+    Rails& rails = *simulated.rails;
+    rails.move(stops.front().second);
+    fmt::print("Device to device moves\n");
+    nanoseconds total{0};
+    for (size_t i = 1; i < stops.size(); i++) {
+        const auto path = planner.route(rails.getPos(), stops[i].second);
+        const auto m = measure([&]() { rails.move(path); });
+        total += m.wall;
+        fmt::print("  {} -> {}: {:.1f}ms, CPU {:.1f}%\n", stops[i - 1].first,
+                   stops[i].first, toMs(m.wall),
+                   100.0 * m.cpu.count() / m.wall.count());
+    }
+    fmt::print("  total {:.1f}ms\n", toMs(total));
+    printJitter(rails.getJitter());
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::warn);
+    benchStepOverhead();
+    benchAxes();
+    benchDeviceMoves();
+    return 0;
+}
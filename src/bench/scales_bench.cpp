@@ -0,0 +1,198 @@
+/**
+ * Compares the scales line parser with the regex one it replaced, by time
+ * and by heap allocations per line. Then weighs on emulated scales with
+ * [scales] settings from ./dist/config.toml, so run it from the repository
+ * root.
+ */
+#include <fmt/core.h>
+#include <spdlog/spdlog.h>
+#include <toml++/toml.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <optional>
+#include <random>
+#include <regex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pawnshop/robust_stats.hpp"
+#include "pawnshop/scales.hpp"
+#include "../tests/sim_scales.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+using namespace pawnshop;
+
+static atomic<size_t> allocations{0};
+// Keeps results of benchmarked code from being optimized out
+static volatile double sink;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* ptr = malloc(size)) {
+        return ptr;
+    }
+    throw bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+/**
+ * Parser that was used before, line by line, including regex built on every
+ * call. Unlike the reference in scales tests, it keeps the original cost.
+ */
+static optional<double> parseWithRegex(const string& line) {
+    const regex entry_format(
+        "(ST|US),(GS|NT)([\\- ][0-9\\. ]{7})([a-z ]{3})",
+        regex_constants::ECMAScript | regex_constants::optimize);
+    smatch submatch;
+    if (!regex_match(line, submatch, entry_format)) {
+        return {};
+    }
+    string weight = submatch[3];
+    string weight_formatted;
+    copy_if(weight.begin(), weight.end(), back_inserter(weight_formatted),
+            [](const char c) { return !isspace(c); });
+    return stod(weight_formatted);
+}
+
+template <typename F>
+void bench(const string& name, const vector<string>& lines, F&& parse) {
+    const size_t rounds = 200;
+    double sum = 0;
+    const size_t allocations_start = allocations;
+    const auto start = steady_clock::now();
+    for (size_t i = 0; i < rounds; i++) {
+        for (const auto& line : lines) {
+            sum += parse(line);
+        }
+    }
+    const auto time = steady_clock::now() - start;
+    const size_t count = rounds * lines.size();
+    fmt::print("{}: {:.1f}ns/line, {:.2f} allocations/line (checksum {})\n",
+               name, duration<double, nano>(time).count() / count,
+               double(allocations - allocations_start) / count, sum);
+}
+
+/**
+ * Cost of estimating weight after every sample, against sorting a copy of
+ * the window for median as getWeight used to
+ */
+void benchEstimators() {
+    mt19937 gen(3);
+    normal_distribution<double> noise(12.345, 0.002);
+    vector<double> input(20000);
+    for (auto& value : input) {
+        value = noise(gen);
+    }
+    const auto perSample = [&](const nanoseconds time) {
+        return duration<double, nano>(time).count() / input.size();
+    };
+
+    for (const size_t size : {20, 200, 2000}) {
+        const auto timeEstimator = [&](const Estimator estimator) {
+            SlidingWindow window(size);
+            double sum = 0;
+            const auto start = steady_clock::now();
+            for (const double value : input) {
+                window.push(value);
+                sum += window.estimate(estimator, 0.1, 3.0).value;
+            }
+            const auto time = steady_clock::now() - start;
+            sink = sum;
+            return perSample(time);
+        };
+
+        vector<double> ring(size), sorted;
+        double sum = 0;
+        const auto start = steady_clock::now();
+        for (size_t i = 0; i < input.size(); i++) {
+            ring[i % size] = input[i];
+            sorted.assign(ring.begin(),
+                          ring.begin() + std::min(i + 1, size));
+            sort(sorted.begin(), sorted.end());
+            sum += sorted[sorted.size() / 2];
+        }
+        const double sorting = perSample(steady_clock::now() - start);
+        sink = sum;
+
+        fmt::print("window {}: sort {:.0f}ns, mean {:.0f}ns, median {:.0f}ns, "
+                   "trimmed mean {:.0f}ns, mad {:.0f}ns per sample\n",
+                   size, sorting, timeEstimator(Estimator::MEAN),
+                   timeEstimator(Estimator::MEDIAN),
+                   timeEstimator(Estimator::TRIMMED_MEAN),
+                   timeEstimator(Estimator::MAD));
+    }
+}
+
+/**
+ * Puts weight on emulated scales and measures how long it takes to weigh it
+ * from that moment and how far off the result is
+ */
+void benchWeighing(const string& name, vector<EmulatedPhase> placing,
+                   const double weight) {
+    const auto empty = EmulatedPhase{1s, 0.0, 0ms, placing.back().noise};
+    placing.insert(placing.begin(), empty);
+    ScaleEmulator emulator(placing, 10.0, 0.005, 1);
+
+    toml::table conf = *toml::parse_file("./dist/config.toml")["scales"]
+                            .as_table();
+    conf.insert_or_assign("uart_path", emulator.path());
+    conf.insert_or_assign("settling_timeout", 15);
+    Scales scales(make_unique<ScalesConfig>(conf));
+
+    const auto placed = emulator.startTime() + empty.duration;
+    this_thread::sleep_until(placed);
+    const auto estimate = scales.getWeight(placed);
+    const auto latency = steady_clock::now() - placed;
+    if (!estimate) {
+        fmt::print("{}: no weight\n", name);
+        return;
+    }
+    fmt::print("{}: {:.0f}ms, error {:+.4f} ± {:.4f}{}\n", name,
+               duration<double, milli>(latency).count(),
+               estimate->weight - weight, estimate->uncertainty,
+               estimate->settled ? "" : ", not settled");
+}
+
+int main() {
+    spdlog::set_level(spdlog::level::err);
+    // Scales stream: settling, then stable, with an occasional broken line
+    vector<string> lines;
+    for (int i = 0; i < 1000; i++) {
+        const bool stable = i % 100 > 20;
+        const double weight = 12.345 + (stable ? 0 : (i % 7) * 0.011);
+        lines.push_back(fmt::format("{},GS {:7.3f} g ", stable ? "ST" : "US",
+                                    weight));
+        if (i % 250 == 0) {
+            lines.push_back("ST,G");
+        }
+    }
+
+    bench("regex", lines, [](const string& line) {
+        return parseWithRegex(line).value_or(0.0);
+    });
+    bench("string_view", lines, [](const string& line) {
+        const auto parsed = Scales::parse(line);
+        return parsed.error == ScaleField::NONE ? parsed.reading.weight : 0.0;
+    });
+
+    benchEstimators();
+
+    const double weight = 12.345;
+    benchWeighing("quiet", {{10s, weight, 300ms, 0.0005}}, weight);
+    benchWeighing("noisy", {{10s, weight, 300ms, 0.003}}, weight);
+    benchWeighing("bumped",
+                  {{1s, weight + 0.5, 0ms, 0.05, true},
+                   {10s, weight, 300ms, 0.0005}},
+                  weight);
+    return 0;
+}
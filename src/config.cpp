@@ -27,18 +27,33 @@ inline Vec3D parseCoord(const toml::array& array) {
     return coord;
 }
 
+inline optional<BoundingBox> parseBoundingBox(const toml::table& device) {
+    auto table = device["bounding_box"].as_table();
+    if (table == nullptr) {
+        return {};
+    }
+    BoundingBox box;
+    box.min = parseCoord(*(*table)["min"].as_array());
+    box.max = parseCoord(*(*table)["max"].as_array());
+    box.clearance = (*table)["clearance"].value_or(10.0);
+    return box;
+}
+
 DevicesConfig::Dryer::Dryer(const toml::table& table) {
     coordinate = parseCoord(*table["coordinate"].as_array());
     duration = parseDuration(*table["duration"].as_table());
+    bounding_box = parseBoundingBox(table);
 }
 
 DevicesConfig::UltrasonicBath::UltrasonicBath(const toml::table& table) {
     coordinate = parseCoord(*table["coordinate"].as_array());
     duration = parseDuration(*table["duration"].as_table());
+    bounding_box = parseBoundingBox(table);
 }
 
 DevicesConfig::Scales::Scales(const toml::table& table) {
     coordinate = parseCoord(*table["coordinate"].as_array());
+    bounding_box = parseBoundingBox(table);
 
     cup = make_unique<Cup>(*table["cup"].as_table());
     power_button = make_unique<PowerButton>(*table["power_button"].as_table());
@@ -47,6 +62,11 @@ DevicesConfig::Scales::Scales(const toml::table& table) {
 DevicesConfig::Scales::Cup::Cup(const toml::table& table) {
     coordinate = parseCoord(*table["coordinate"].as_array());
     desired_weight = table["desired_weight"].value<double>().value();
+    if (auto timeout = table["fill_timeout"].as_table()) {
+        fill_timeout = parseDuration(*timeout);
+    } else {
+        fill_timeout = chrono::seconds(30);
+    }
 }
 
 DevicesConfig::Scales::PowerButton::PowerButton(const toml::table& table) {
@@ -55,6 +75,7 @@ DevicesConfig::Scales::PowerButton::PowerButton(const toml::table& table) {
 
 DevicesConfig::GoldReciever::GoldReciever(const toml::table& table) {
     coordinate = parseCoord(*table["coordinate"].as_array());
+    bounding_box = parseBoundingBox(table);
 }
 
 DevicesConfig::DevicesConfig(const toml::table& table) {
@@ -68,11 +89,28 @@ DevicesConfig::DevicesConfig(const toml::table& table) {
         make_unique<GoldReciever>(*table["gold_reciever"].as_table());
 }
 
+optional<vector<BoundingBox>> DevicesConfig::boundingBoxes() const {
+    vector<BoundingBox> boxes;
+    for (const auto& box :
+         {dryer->bounding_box, ultrasonic_bath->bounding_box,
+          scales->bounding_box, gold_reciever->bounding_box}) {
+        if (!box) {
+            return {};
+        }
+        boxes.push_back(*box);
+    }
+    return boxes;
+}
+
 Config::Config(const string& toml_path) {
     auto table = toml::parse_file(toml_path);
 
     scales = make_unique<ScalesConfig>(*table["scales"].as_table());
     rails = make_unique<RailsConfig>(*table["rails"].as_table());
+    // Optional section, stepping thread keeps default scheduling without it
+    auto realtime_table = table["realtime"].as_table();
+    realtime = make_unique<RealtimeConfig>(realtime_table ? *realtime_table
+                                                          : toml::table{});
     db = make_unique<DbConfig>(*table["db"].as_table());
     devices = make_unique<DevicesConfig>(*table["devices"].as_table());
     mqtt = make_unique<MqttConfig>(*table["mqtt"].as_table());
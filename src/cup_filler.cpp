@@ -0,0 +1,65 @@
+#include "pawnshop/cup_filler.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace pawnshop {
+
+CupFiller::CupFiller(Scales& scales, StartPump start, StopPump stop)
+    : scales(scales), start(std::move(start)), stop(std::move(stop)) {}
+
+FillResult CupFiller::fill(const double from, const double target,
+                           const nanoseconds timeout,
+                           const CancellationToken& cancel) {
+    mutex mx;
+    condition_variable cv;
+    optional<double> reached;
+    // Pump is stopped from this thread, so reader thread is not held up by
+    // sending the command
+    const auto subscription = scales.subscribe([&](const ScaleSample& s) {
+        if (s.weight >= target) {
+            {
+                lock_guard lk(mx);
+                if (!reached) {
+                    reached = s.weight;
+                }
+            }
+            cv.notify_all();
+        }
+    });
+    // Wakes the wait below even while scales are silent. Locked, so the
+    // notification isn't lost between check and wait.
+    const auto wakeup = cancel.onCancel([&]() {
+        { lock_guard lk(mx); }
+        cv.notify_all();
+    });
+
+    const auto start_time = steady_clock::now();
+    start(target - from);
+    unique_lock lk(mx);
+    cv.wait_for(lk, timeout, [&]() {
+        return reached.has_value() || cancel.cancelled();
+    });
+    stop();
+    const auto time = steady_clock::now() - start_time;
+
+    if (!reached) {
+        const auto last = scales.latest();
+        const double weight = last ? last->weight : from;
+        if (!cancel.cancelled()) {
+            spdlog::warn("Cup is not filled in {}s, weight {} of {}",
+                         duration_cast<seconds>(timeout).count(), weight,
+                         target);
+        }
+        return {weight, false, time};
+    }
+    return {*reached, true, time};
+}
+
+}  // namespace pawnshop
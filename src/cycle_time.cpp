@@ -0,0 +1,304 @@
+#include "pawnshop/cycle_time.hpp"
+
+#include <doctest/doctest.h>
+#include <toml++/toml.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "pawnshop/axis.hpp"
+#include "pawnshop/sim_gpio.hpp"
+#include "pawnshop/step_bus.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+using namespace pawnshop::vec;
+
+namespace pawnshop {
+
+nanoseconds PhaseTime::total() const { return motion + waiting; }
+
+/**
+ * Follows carriage through a routine and sums up time of every phase.
+ * Mirrors controller routines move by move.
+ */
+class CycleTimeEstimator::Trip {
+public:
+    Trip(const CycleTimeEstimator& estimator, const Vec3D& start)
+        : est(estimator), pos(start) {}
+
+    void phase(const string& name) { phases.push_back({name}); }
+    nanoseconds move(const vector<Vec3D>& waypoints) {
+        const auto time = est.moveTime(pos, waypoints);
+        pos = waypoints.back();
+        phases.back().motion += time;
+        return time;
+    }
+    nanoseconds routeTo(const Vec3D& target) {
+        return move(est.planner.route(pos, target));
+    }
+    void wait(const nanoseconds time) { phases.back().waiting += time; }
+    /**
+     * Adds waiting that runs during motion, i.e. weighing while moving
+     */
+    void overlap(const nanoseconds motion, const nanoseconds waiting) {
+        wait(std::max(waiting - motion, 0ns));
+    }
+
+    void pickingUp() {
+        const auto& reciever_coord = est.dev.gold_reciever->coordinate;
+        phase("Picking up gold");
+        auto path = est.planner.route(pos, reciever_coord);
+        path.push_back(est.planner.above(reciever_coord));
+        // Baseline is measured while carriage picks up gold
+        overlap(move(path), est.weighing);
+    }
+
+    void scaleWeighting(const string& name) {
+        const auto& scale_coord = est.dev.scales->coordinate;
+        phase(name);
+        routeTo(scale_coord);
+        wait(est.weighing);
+        move({est.planner.above(scale_coord)});
+    }
+
+    void submergedWeighting(const string& name) {
+        const auto& cup_coord = est.dev.scales->cup->coordinate;
+        const Vec3D cup_top_coord = est.planner.above(cup_coord);
+        const Vec3D cup_bottom_coord = {cup_coord[0], cup_coord[1],
+                                        std::max(cup_coord[2] - 10.0, 0.0)};
+        phase(name);
+        routeTo(cup_top_coord);
+        auto path = est.planner.route(pos, cup_bottom_coord);
+        path.push_back(cup_coord);
+        move(path);
+        wait(est.weighing);
+        move({cup_top_coord});
+    }
+
+    void washing() {
+        const auto& usbath = *est.dev.ultrasonic_bath;
+        phase("Washing");
+        routeTo(usbath.coordinate);
+        wait(1s + usbath.duration + 1s);
+        move({est.planner.above(usbath.coordinate)});
+    }
+
+    void drying() {
+        const auto& dryer = *est.dev.dryer;
+        phase("Drying");
+        routeTo(dryer.coordinate);
+        wait(dryer.duration + 1s);
+        move({est.planner.above(dryer.coordinate)});
+    }
+
+    void parking() {
+        phase("Parking");
+        routeTo(est.planner.above(est.dev.gold_reciever->coordinate));
+    }
+
+    const CycleTimeEstimator& est;
+    Vec3D pos;
+    vector<PhaseTime> phases;
+};
+
+CycleTimeEstimator::CycleTimeEstimator(const RailsConfig& rails,
+                                       const DevicesConfig& devices,
+                                       const nanoseconds weighing)
+    : homing_order(rails.homing_order),
+      dev(devices),
+      planner(dev.boundingBoxes(), dev.safe_height),
+      weighing(weighing) {
+    // Homing is run on simulated rails without waiting between steps, so
+    // its time comes from the same code as on real rails
+    gpio::SimulatedBackend sim(rails);
+    sim.setRecording(false);
+    vector<size_t> clock_pins, dir_pins;
+    for (const auto& axis : rails.axes) {
+        clock_pins.push_back(axis->motor->clock_pin);
+        dir_pins.push_back(axis->motor->direction_pin);
+    }
+    auto bus = make_shared<StepBus>(sim, clock_pins, dir_pins);
+    for (size_t i = 0; i < rails.axes.size(); i++) {
+        sim.setPosition(i, rails.axes[i]->steps);
+        // Rails take the config later, axis gets its own copy
+        Axis axis(sim, bus, i, make_unique<AxisConfig>(*rails.axes[i]));
+        kinematics[i] = {axis.getStepLength(), axis.getLimits()};
+
+        Axis::Homing homing(axis);
+        axis_homing[i] = 0ns;
+        while (const auto interval = homing.next()) {
+            bus->setClocks(axis.getClockMask(), true);
+            bus->setClocks(axis.getClockMask(), false);
+            axis_homing[i] += *interval;
+        }
+    }
+}
+
+nanoseconds CycleTimeEstimator::moveTime(
+    const Vec3D& from, const vector<Vec3D>& waypoints) const {
+    nanoseconds time{0};
+    const auto path =
+        planPath(kinematics, toSteps(kinematics, from), waypoints);
+    for (size_t k = 0; k < path.size(); k++) {
+        time += path[k].profile().duration();
+        // Rails rest for a step interval at stops between segments
+        if (path[k].exit_speed == 0 && k + 1 < path.size()) {
+            time += duration_cast<nanoseconds>(duration<double>(
+                path[k].length / path[k].ticks / path[k].limits.min_speed));
+        }
+    }
+    return time;
+}
+
+nanoseconds CycleTimeEstimator::homingTime() const {
+    nanoseconds time{0};
+    for (const auto& group : homing_order) {
+        nanoseconds longest{0};
+        for (const size_t axis : group) {
+            longest = std::max(longest, axis_homing[axis]);
+        }
+        time += longest;
+    }
+    return time;
+}
+
+vector<PhaseTime> CycleTimeEstimator::measure() const {
+    Trip trip(*this, planner.above(dev.gold_reciever->coordinate));
+    trip.pickingUp();
+    trip.scaleWeighting("Dirty weighing");
+    trip.washing();
+    trip.drying();
+    trip.scaleWeighting("Clean weighing");
+    trip.submergedWeighting("Submerged weighing");
+    trip.drying();
+    trip.parking();
+    return trip.phases;
+}
+
+vector<PhaseTime> CycleTimeEstimator::calibrate() const {
+    Trip trip(*this, {0, 0, 0});
+    trip.phase("Homing");
+    trip.phases.back().motion += homingTime();
+    trip.move({{0, 0, dev.safe_height}});
+    trip.scaleWeighting("Caret weighing");
+    trip.submergedWeighting("Caret submerged weighing");
+    trip.drying();
+    trip.parking();
+    return trip.phases;
+}
+
+TEST_CASE("CycleTimeEstimator") {
+    const auto rails_table = toml::parse(R"(
+        gpio_chip = ''
+        backend = 'simulated'
+        homing_order = [['z'], ['x', 'y']]
+        [x_axis]
+        length = 100.0
+        steps = 10000
+        min_speed = 10.0
+        max_speed = 100.0
+        acceleration = 1000.0
+        [x_axis.motor]
+        clock_pin = 1
+        direction_pin = 2
+        counter_clockwise = false
+        [x_axis.limit_switches.negative]
+        pin = 3
+        [y_axis]
+        length = 100.0
+        steps = 10000
+        min_speed = 10.0
+        max_speed = 100.0
+        acceleration = 1000.0
+        [y_axis.motor]
+        clock_pin = 4
+        direction_pin = 5
+        counter_clockwise = false
+        [y_axis.limit_switches.negative]
+        pin = 6
+        [z_axis]
+        length = 50.0
+        steps = 10000
+        min_speed = 5.0
+        max_speed = 50.0
+        acceleration = 500.0
+        [z_axis.motor]
+        clock_pin = 7
+        direction_pin = 8
+        counter_clockwise = false
+        [z_axis.limit_switches.negative]
+        pin = 9
+    )");
+    // Devices stand at safe height, only scales and bath are 50mm along X
+    // from the rest, so every move but those is empty
+    const auto devices_table = toml::parse(R"(
+        safe_height = 10.0
+        [dryer]
+        coordinate = [10.0, 10.0, 10.0]
+        duration = {value = 4, unit = 's'}
+        [ultrasonic_bath]
+        coordinate = [60.0, 10.0, 10.0]
+        duration = {value = 3, unit = 's'}
+        [scales]
+        coordinate = [60.0, 10.0, 10.0]
+        [scales.cup]
+        coordinate = [10.0, 10.0, 10.0]
+        desired_weight = 64.0
+        [scales.power_button]
+        coordinate = [0.0, 0.0, 10.0]
+        [gold_reciever]
+        coordinate = [10.0, 10.0, 10.0]
+    )");
+    const RailsConfig rails(rails_table);
+    const DevicesConfig devices(devices_table);
+    const CycleTimeEstimator estimator(rails, devices, 2s);
+
+    // Reciever to scales, a single X move
+    const auto& x = *rails.axes[0];
+    const ProfileLimits x_limits{x.min_speed, x.max_speed, x.acceleration,
+                                 x.jerk};
+    const auto x_move = StepProfile(5000, x.length / x.steps, x_limits)
+                            .duration();
+    const auto near = [](const nanoseconds a, const nanoseconds b) {
+        return a - b < 1us && b - a < 1us;
+    };
+
+    SUBCASE("Measurement phases") {
+        const auto phases = estimator.measure();
+        REQUIRE(phases.size() == 8);
+        CHECK(phases[0].name == "Picking up gold");
+        CHECK(phases[0].total() == 2s);
+        CHECK(phases[1].name == "Dirty weighing");
+        CHECK(near(phases[1].motion, x_move));
+        CHECK(phases[1].waiting == 2s);
+        CHECK(phases[2].name == "Washing");
+        CHECK(phases[2].total() == 5s);
+        CHECK(phases[3].name == "Drying");
+        CHECK(near(phases[3].motion, x_move));
+        CHECK(phases[3].waiting == 5s);
+        CHECK(near(phases[4].total(), x_move + 2s));
+        CHECK(phases[7].name == "Parking");
+        CHECK(phases[7].total() == 0s);
+    }
+
+    SUBCASE("Homing") {
+        // Z is homed alone, then X and Y together, each from its far end.
+        // Without overtravel switches are approached at min_speed.
+        const auto approach = [](const AxisConfig& axis) {
+            return duration_cast<nanoseconds>(
+                duration<double>(axis.length / axis.homing_fast_speed));
+        };
+        CHECK(x.homing_fast_speed == x.min_speed);
+        const auto z_crawl = approach(*rails.axes[2]);
+        const auto xy_crawl = approach(x);
+        CHECK(estimator.homingTime() > z_crawl + xy_crawl);
+        const auto phases = estimator.calibrate();
+        REQUIRE(!phases.empty());
+        CHECK(phases[0].name == "Homing");
+        CHECK(phases[0].motion >= estimator.homingTime());
+    }
+}
+
+}  // namespace pawnshop
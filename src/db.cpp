@@ -52,6 +52,23 @@ void from_json(const nlohmann::json& j, CalibrationInfo& i) {
     j.at("caret_submerged_weight").get_to(i.caret_submerged_weight);
 }
 
+void to_json(json& j, const MeasurementJob& job) {
+    j = {{"id", job.id},
+         {"product_id", job.product_id},
+         {"priority", job.priority},
+         {"queued_time", std::chrono::time_point_cast<seconds>(job.queued_time)
+                             .time_since_epoch()
+                             .count()}};
+}
+
+void from_json(const nlohmann::json& j, MeasurementJob& job) {
+    job.id = j.value("id", int64_t{0});
+    j.at("product_id").get_to(job.product_id);
+    job.priority = j.value("priority", int64_t{0});
+    const auto epoch = j.value("queued_time", int64_t{0});
+    job.queued_time = system_clock::time_point{seconds{epoch}};
+}
+
 DbConfig::DbConfig(const toml::table& table) {
     path = table["path"].value<string>().value();
 }
@@ -74,6 +91,12 @@ Db::Db(const string& db_path) {
                  u8"CREATE TABLE IF NOT EXISTS calibrationInfo ("
                  u8"    caretWeight REAL NOT NULL,"
                  u8"    caretSubmergedWeight REAL NOT NULL"
+                 u8");"
+                 u8"CREATE TABLE IF NOT EXISTS measurementJobs ("
+                 u8"    id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                 u8"    productId INTEGER NOT NULL,"
+                 u8"    priority INTEGER NOT NULL,"
+                 u8"    queuedTime INTEGER NOT NULL"
                  u8");",
                  nullptr, nullptr, nullptr);
 }
@@ -240,6 +263,54 @@ size_t Db::getMeasurementsAmount() {
     return count;
 }
 
+int64_t Db::enqueueJob(const MeasurementJob& j) {
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db,
+                       u8"INSERT INTO measurementJobs (productId, priority, "
+                       u8"queuedTime) VALUES ($product, $priority, $queued) "
+                       u8"RETURNING id;",
+                       -1, &stmt, nullptr);
+    sqlite3_bind_int64(stmt, 1, j.product_id);
+    sqlite3_bind_int64(stmt, 2, j.priority);
+    sqlite3_bind_int64(stmt, 3,
+                       std::chrono::time_point_cast<seconds>(j.queued_time)
+                           .time_since_epoch()
+                           .count());
+    sqlite3_step(stmt);
+    int64_t id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+    return id;
+}
+
+vector<MeasurementJob> Db::getJobs() {
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db,
+                       u8"SELECT * FROM measurementJobs "
+                       u8"ORDER BY priority DESC, id ASC;",
+                       -1, &stmt, nullptr);
+    vector<MeasurementJob> jobs;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        MeasurementJob j;
+        j.id = sqlite3_column_int64(stmt, 0);
+        j.product_id = sqlite3_column_int64(stmt, 1);
+        j.priority = sqlite3_column_int64(stmt, 2);
+        j.queued_time =
+            system_clock::time_point{seconds{sqlite3_column_int64(stmt, 3)}};
+        jobs.push_back(j);
+    }
+    sqlite3_finalize(stmt);
+    return jobs;
+}
+
+void Db::removeJob(int64_t id) {
+    sqlite3_stmt* stmt;
+    sqlite3_prepare_v2(db, u8"DELETE FROM measurementJobs WHERE id = $id;",
+                       -1, &stmt, nullptr);
+    sqlite3_bind_int64(stmt, 1, id);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+}
+
 TEST_CASE("DB") {
     using namespace std::string_view_literals;
 
@@ -315,6 +386,40 @@ TEST_CASE("DB") {
         }
     }
 
+    SUBCASE("Jobs") {
+        MeasurementJob j;
+        j.queued_time = system_clock::now();
+        j.priority = 0;
+        j.product_id = 1;
+        const auto first = db->enqueueJob(j);
+        j.product_id = 2;
+        db->enqueueJob(j);
+        j.product_id = 3;
+        j.priority = 1;
+        db->enqueueJob(j);
+
+        auto jobs = db->getJobs();
+        REQUIRE(jobs.size() == 3);
+        CHECK(jobs[0].product_id == 3);
+        CHECK(jobs[1].product_id == 1);
+        CHECK(jobs[2].product_id == 2);
+
+        // Queue survives reopening
+        delete db;
+        db = new Db(make_unique<DbConfig>(tbl));
+        db->removeJob(first);
+        jobs = db->getJobs();
+        REQUIRE(jobs.size() == 2);
+        CHECK(jobs[0].product_id == 3);
+        CHECK(jobs[1].product_id == 2);
+
+        // Ids of finished jobs aren't given to new ones, even the last id
+        const auto last = jobs[0].id;
+        db->removeJob(last);
+        j.product_id = 4;
+        CHECK(db->enqueueJob(j) > last);
+    }
+
     delete db;
     remove(db_path.c_str());
 };
@@ -0,0 +1,47 @@
+#include "pawnshop/gpio.hpp"
+
+using namespace std;
+
+namespace pawnshop {
+namespace gpio {
+
+class GpiodOutputs : public Outputs {
+public:
+    GpiodOutputs(gpiod::line_bulk lines) : lines(std::move(lines)) {}
+    void setValues(const vector<int>& values) override {
+        lines.set_values(values);
+    }
+
+private:
+    gpiod::line_bulk lines;
+};
+
+class GpiodInput : public Input {
+public:
+    GpiodInput(gpiod::line line) : line(std::move(line)) {}
+    int getValue() const override { return line.get_value(); }
+
+private:
+    gpiod::line line;
+};
+
+GpiodBackend::GpiodBackend(const string& chip_name) : chip{chip_name} {}
+
+unique_ptr<Outputs> GpiodBackend::requestOutputs(const vector<size_t>& pins,
+                                                 const string& consumer) {
+    gpiod::line_bulk lines =
+        chip.get_lines(vector<unsigned int>(pins.begin(), pins.end()));
+    lines.request({consumer, gpiod::line_request::DIRECTION_OUTPUT, 0},
+                  vector<int>(pins.size(), 0));
+    return make_unique<GpiodOutputs>(std::move(lines));
+}
+
+unique_ptr<Input> GpiodBackend::requestInput(const size_t pin,
+                                             const string& consumer) {
+    gpiod::line line = chip.get_line(pin);
+    line.request({consumer, gpiod::line_request::DIRECTION_INPUT, 0});
+    return make_unique<GpiodInput>(std::move(line));
+}
+
+}  // namespace gpio
+}  // namespace pawnshop
@@ -8,16 +8,13 @@ LimitSwitchConfig::LimitSwitchConfig(const toml::table& table) {
     pin = table["pin"].value<size_t>().value();
 }
 
-LimitSwitch::LimitSwitch(gpiod::chip chip, size_t offset) {
-    line = chip.get_line(offset);
-    line.request(
-        {"pawnshop-limitswitch", gpiod::line_request::DIRECTION_INPUT, 0});
-}
+LimitSwitch::LimitSwitch(gpio::Backend& backend, size_t offset)
+    : line(backend.requestInput(offset, "pawnshop-limitswitch")) {}
 
-LimitSwitch::LimitSwitch(gpiod::chip chip,
+LimitSwitch::LimitSwitch(gpio::Backend& backend,
                          const unique_ptr<LimitSwitchConfig> conf)
-    : LimitSwitch{chip, conf->pin} {}
+    : LimitSwitch{backend, conf->pin} {}
 
-LimitSwitch::operator bool() const { return !line.get_value(); }
+LimitSwitch::operator bool() const { return !line->getValue(); }
 
 }  // namespace pawnshop
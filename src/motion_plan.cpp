@@ -0,0 +1,234 @@
+#include "pawnshop/motion_plan.hpp"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace pawnshop::vec;
+
+namespace pawnshop {
+
+Segment::Segment(const RailsKinematics& axes, const array<int64_t, 3>& from,
+                 const array<int64_t, 3>& to)
+    : ticks(0) {
+    Vec3D track;
+    for (size_t i = 0; i < axes.size(); i++) {
+        steps[i] = to[i] - from[i];
+        track[i] = steps[i] * axes[i].step_length;
+        ticks = std::max<uint64_t>(ticks, std::abs(steps[i]));
+    }
+    length = vec::length(track);
+    direction = ticks == 0 ? Vec3D{0, 0, 0} : track / length;
+
+    const double inf = numeric_limits<double>::infinity();
+    limits = {inf, inf, inf, 0};
+    for (size_t i = 0; i < axes.size(); i++) {
+        if (steps[i] == 0) {
+            continue;
+        }
+        const double k = std::abs(direction[i]);
+        const ProfileLimits& axis = axes[i].limits;
+        limits.min_speed = std::min(limits.min_speed, axis.min_speed / k);
+        limits.max_speed = std::min(limits.max_speed, axis.max_speed / k);
+        limits.acceleration =
+            std::min(limits.acceleration, axis.acceleration / k);
+        if (axis.jerk > 0) {
+            limits.jerk = limits.jerk > 0
+                              ? std::min(limits.jerk, axis.jerk / k)
+                              : axis.jerk / k;
+        }
+    }
+}
+
+StepProfile Segment::profile() const {
+    return StepProfile(ticks, ticks == 0 ? 0 : length / ticks, limits,
+                       entry_speed, exit_speed);
+}
+
+array<int64_t, 3> toSteps(const RailsKinematics& axes, const Vec3D& pos) {
+    array<int64_t, 3> steps;
+    for (size_t i = 0; i < axes.size(); i++) {
+        steps[i] = std::llround(pos[i] / axes[i].step_length);
+    }
+    return steps;
+}
+
+/**
+ * @returns Highest speed at which direction can change from one segment to
+ * the other, while speed of every axis changes by no more than its min_speed
+ */
+inline double junctionSpeed(const RailsKinematics& axes, const Segment& in,
+                            const Segment& out) {
+    double v = std::min(in.limits.max_speed, out.limits.max_speed);
+    for (size_t i = 0; i < axes.size(); i++) {
+        const double change = std::abs(in.direction[i] - out.direction[i]);
+        if (change > 0) {
+            v = std::min(v, axes[i].limits.min_speed / change);
+        }
+    }
+    return v;
+}
+
+/**
+ * @returns True if speed of every axis changes by no more than its min_speed
+ * at junction passed at speed v, as executed by profiles of both segments
+ */
+inline bool junctionFits(const RailsKinematics& axes, const Segment& in,
+                         const Segment& out, const double v) {
+    const auto executed = [v](const Segment& s) {
+        return std::clamp(v, std::min(s.limits.min_speed, s.limits.max_speed),
+                          s.limits.max_speed);
+    };
+    const double v_in = executed(in), v_out = executed(out);
+    for (size_t i = 0; i < axes.size(); i++) {
+        const double change =
+            std::abs(v_in * in.direction[i] - v_out * out.direction[i]);
+        // Tolerates rounding of speeds computed from the same limit
+        if (change > axes[i].limits.min_speed * (1 + 1e-9)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+vector<Segment> planPath(const RailsKinematics& axes,
+                         const array<int64_t, 3>& from,
+                         const vector<Vec3D>& waypoints) {
+    vector<Segment> path;
+    array<int64_t, 3> pos = from;
+    for (const auto& waypoint : waypoints) {
+        const auto next = toSteps(axes, waypoint);
+        Segment segment(axes, pos, next);
+        if (segment.ticks == 0) {
+            continue;
+        }
+        path.push_back(segment);
+        pos = next;
+    }
+    if (path.empty()) {
+        return path;
+    }
+
+    // Speed at every junction, carriage starts and ends at full stop
+    vector<double> v(path.size() + 1, 0);
+    for (size_t k = 1; k < path.size(); k++) {
+        v[k] = junctionSpeed(axes, path[k - 1], path[k]);
+    }
+    // Backward pass makes sure carriage can slow down in time for every
+    // following junction, forward pass - that junction speed can be reached.
+    // Passes only lower speeds, which may push a junction below min_speed, so
+    // they are repeated until no more junctions turn into stops.
+    bool stops_added = true;
+    while (stops_added) {
+        for (size_t k = path.size(); k-- > 0;) {
+            v[k] = std::min(v[k], reachableSpeed(v[k + 1], path[k].length,
+                                                 path[k].limits));
+        }
+        for (size_t k = 0; k < path.size(); k++) {
+            v[k + 1] = std::min(v[k + 1], reachableSpeed(v[k], path[k].length,
+                                                         path[k].limits));
+        }
+        stops_added = false;
+        for (size_t k = 1; k < path.size(); k++) {
+            if (v[k] > 0 && !junctionFits(axes, path[k - 1], path[k], v[k])) {
+                v[k] = 0;
+                stops_added = true;
+            }
+        }
+    }
+    for (size_t k = 0; k < path.size(); k++) {
+        path[k].entry_speed = v[k];
+        path[k].exit_speed = v[k + 1];
+    }
+    return path;
+}
+
+TEST_CASE("Path planning") {
+    const ProfileLimits limits{30.0, 600.0, 100.0};
+    const RailsKinematics axes{AxisKinematics{0.01, limits},
+                               AxisKinematics{0.01, limits},
+                               AxisKinematics{0.01, limits}};
+    const array<int64_t, 3> origin{0, 0, 0};
+
+    SUBCASE("Straight line") {
+        auto path = planPath(axes, origin, {{100, 0, 0}, {200, 0, 0}});
+        REQUIRE(path.size() == 2);
+        CHECK(path[0].entry_speed == 0);
+        CHECK(path[1].exit_speed == 0);
+        // Doesn't slow down between collinear segments
+        CHECK(path[0].exit_speed == doctest::Approx(reachableSpeed(
+                                        0, path[0].length, path[0].limits)));
+        CHECK(path[1].entry_speed == path[0].exit_speed);
+    }
+
+    // Speed change of every axis at junctions not planned as stops, as
+    // executed by step profiles
+    const auto checkJunctions = [&](const vector<Segment>& path) {
+        for (size_t k = 1; k < path.size(); k++) {
+            CAPTURE(k);
+            const auto& in = path[k - 1];
+            const auto& out = path[k];
+            REQUIRE(in.exit_speed == out.entry_speed);
+            if (in.exit_speed == 0) {
+                continue;
+            }
+            const double v_in = in.profile().exitSpeed();
+            const double v_out = out.profile().entrySpeed();
+            for (size_t i = 0; i < axes.size(); i++) {
+                CHECK(std::abs(v_in * in.direction[i] -
+                               v_out * out.direction[i]) <=
+                      limits.min_speed + 1e-9);
+            }
+        }
+    };
+
+    SUBCASE("Reversal") {
+        auto path = planPath(axes, origin, {{0, 0, 100}, {0, 0, 50}});
+        REQUIRE(path.size() == 2);
+        // Profiles can't go below min_speed, so the only way to reverse
+        // without a jump is to stop
+        CHECK(path[0].exit_speed == 0);
+        CHECK(path[1].entry_speed == 0);
+        CHECK(path[0].profile().exitSpeed() == limits.min_speed);
+        CHECK(path[1].profile().entrySpeed() == limits.min_speed);
+    }
+
+    SUBCASE("Sharp corners") {
+        auto path = planPath(axes, origin,
+                             {{100, 0, 0},
+                              {100, 100, 0},
+                              {0, 90, 0},
+                              {50, 50, 10},
+                              {60, 40, 0}});
+        REQUIRE(path.size() == 5);
+        // Right angle is taken at min_speed of both axes
+        CHECK(path[0].exit_speed == doctest::Approx(limits.min_speed));
+        CHECK(path[1].exit_speed == 0);
+        checkJunctions(path);
+    }
+
+    SUBCASE("Shallow corner") {
+        auto path = planPath(axes, origin, {{100, 0, 100}, {200, 0, 120}});
+        REQUIRE(path.size() == 2);
+        CHECK(path[0].exit_speed > limits.min_speed);
+        checkJunctions(path);
+    }
+
+    SUBCASE("Diagonal segment limits") {
+        auto path = planPath(axes, origin, {{100, 100, 0}});
+        REQUIRE(path.size() == 1);
+        CHECK(path[0].ticks == 10000);
+        CHECK(path[0].limits.max_speed ==
+              doctest::Approx(600.0 * std::sqrt(2.0)));
+    }
+
+    SUBCASE("Empty segments skipped") {
+        auto path = planPath(axes, origin, {{0, 0, 0}, {10, 0, 0}, {10, 0, 0}});
+        CHECK(path.size() == 1);
+    }
+}
+
+}  // namespace pawnshop
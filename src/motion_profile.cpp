@@ -0,0 +1,334 @@
+#include "pawnshop/motion_profile.hpp"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace pawnshop {
+
+namespace {
+
+/**
+ * Velocity change from v_0 to v_peak with limited acceleration and
+ * (optionally) jerk. Consists of 3 phases: acceleration rises with constant
+ * jerk, stays constant and then falls back to 0 with constant jerk.
+ */
+struct Ramp {
+    double v_0;
+    double v_peak;
+    double jerk;
+    // Highest acceleration reached, can be lower than limit for short ramps
+    double a_peak;
+    // Duration of phases with changing acceleration
+    double t_jerk;
+    // Duration of phase with constant acceleration
+    double t_accel;
+
+    Ramp(const double v_0, const double v_peak, const double a,
+         const double jerk)
+        : v_0(v_0), v_peak(v_peak), jerk(jerk) {
+        const double dv = v_peak - v_0;
+        if (jerk <= 0) {
+            a_peak = a;
+            t_jerk = 0;
+            t_accel = dv / a;
+        } else if (dv >= a * a / jerk) {
+            a_peak = a;
+            t_jerk = a / jerk;
+            t_accel = dv / a - t_jerk;
+        } else {
+            t_jerk = std::sqrt(dv / jerk);
+            a_peak = jerk * t_jerk;
+            t_accel = 0;
+        }
+    }
+
+    double duration() const { return 2 * t_jerk + t_accel; }
+
+    // Velocity curve is symmetric around its middle point
+    double distance() const { return (v_0 + v_peak) / 2 * duration(); }
+
+    double velocity(double t) const {
+        if (t < t_jerk) {
+            return v_0 + jerk * t * t / 2;
+        }
+        const double v_1 = v_0 + jerk * t_jerk * t_jerk / 2;
+        t -= t_jerk;
+        if (t < t_accel) {
+            return v_1 + a_peak * t;
+        }
+        const double v_2 = v_1 + a_peak * t_accel;
+        t = std::min(t - t_accel, t_jerk);
+        return v_2 + a_peak * t - jerk * t * t / 2;
+    }
+
+    double position(double t) const {
+        if (t < t_jerk) {
+            return v_0 * t + jerk * t * t * t / 6;
+        }
+        const double v_1 = v_0 + jerk * t_jerk * t_jerk / 2;
+        const double s_1 = v_0 * t_jerk + jerk * t_jerk * t_jerk * t_jerk / 6;
+        t -= t_jerk;
+        if (t < t_accel) {
+            return s_1 + v_1 * t + a_peak * t * t / 2;
+        }
+        const double v_2 = v_1 + a_peak * t_accel;
+        const double s_2 = s_1 + v_1 * t_accel + a_peak * t_accel * t_accel / 2;
+        t = std::min(t - t_accel, t_jerk);
+        return s_2 + v_2 * t + a_peak * t * t / 2 - jerk * t * t * t / 6;
+    }
+
+    /**
+     * Inverse of position(t), Newton's method with bisection fallback
+     *
+     * @param t_min: Lower bound for result, e.g. time of previous step
+     */
+    double timeAt(const double s, const double t_min) const {
+        double lo = t_min, hi = duration();
+        double t = lo;
+        for (size_t i = 0; i < 64 && hi - lo > 1e-10; i++) {
+            const double err = position(t) - s;
+            if (err > 0) {
+                hi = t;
+            } else {
+                lo = t;
+            }
+            const double v = velocity(t);
+            double next = v > 0 ? t - err / v : lo;
+            if (next <= lo || next >= hi) {
+                next = (lo + hi) / 2;
+            }
+            if (std::abs(next - t) < 1e-12) {
+                break;
+            }
+            t = next;
+        }
+        return t;
+    }
+};
+
+inline nanoseconds toNanoseconds(const double seconds) {
+    return nanoseconds{std::llround(seconds * 1e9)};
+}
+
+/**
+ * @returns Intervals between steps while speed changes along the ramp,
+ * limited to max_steps
+ */
+vector<nanoseconds> rampIntervals(const Ramp& ramp, const double step_length,
+                                  const uint64_t max_steps) {
+    const uint64_t ramp_steps = std::min<uint64_t>(
+        static_cast<uint64_t>(ramp.distance() / step_length), max_steps);
+    vector<nanoseconds> intervals;
+    intervals.reserve(ramp_steps);
+    // Intervals are taken between rounded absolute times, so rounding errors
+    // don't accumulate over the ramp
+    double t = 0;
+    nanoseconds prev_step_time{0};
+    for (uint64_t i = 1; i <= ramp_steps; i++) {
+        t = ramp.timeAt(i * step_length, t);
+        const nanoseconds step_time = toNanoseconds(t);
+        intervals.push_back(step_time - prev_step_time);
+        prev_step_time = step_time;
+    }
+    return intervals;
+}
+
+}  // namespace
+
+double rampDistance(const double v_from, const double v_to,
+                    const ProfileLimits& limits) {
+    const double v_0 = std::min(limits.min_speed, limits.max_speed);
+    const double lo = std::max(std::min(v_from, v_to), v_0);
+    const double hi = std::min(std::max(v_from, v_to), limits.max_speed);
+    if (hi <= lo) {
+        return 0;
+    }
+    if (limits.acceleration <= 0) {
+        return numeric_limits<double>::infinity();
+    }
+    return Ramp(lo, hi, limits.acceleration, limits.jerk).distance();
+}
+
+double reachableSpeed(const double v_from, const double distance,
+                      const ProfileLimits& limits) {
+    const double v_max = limits.max_speed;
+    const double v_start = std::clamp(v_from, std::min(limits.min_speed, v_max),
+                                      v_max);
+    if (rampDistance(v_start, v_max, limits) <= distance) {
+        return v_max;
+    }
+    double lo = v_start, hi = v_max;
+    for (size_t i = 0; i < 64; i++) {
+        const double mid = (lo + hi) / 2;
+        if (rampDistance(v_start, mid, limits) > distance) {
+            hi = mid;
+        } else {
+            lo = mid;
+        }
+    }
+    return lo;
+}
+
+StepProfile::StepProfile(const uint64_t steps, const double step_length,
+                         const ProfileLimits& limits,
+                         const double entry_speed /* = 0 */,
+                         const double exit_speed /* = 0 */)
+    : steps(steps) {
+    const double v_max = limits.max_speed;
+    const double v_0 = std::min(limits.min_speed, v_max);
+    // Motor can change speed instantly within min_speed
+    const double v_entry = std::clamp(entry_speed, v_0, v_max);
+    const double v_exit = std::clamp(exit_speed, v_0, v_max);
+    const double distance = steps * step_length;
+    const auto ramps_distance = [&](const double v) {
+        return rampDistance(v_entry, v, limits) +
+               rampDistance(v_exit, v, limits);
+    };
+
+    // Find highest speed that can be reached and still leave enough distance
+    // to slow down to exit speed
+    double v_peak = v_max;
+    if (ramps_distance(v_max) > distance) {
+        double lo = std::max(v_entry, v_exit), hi = v_max;
+        for (size_t i = 0; i < 64; i++) {
+            const double mid = (lo + hi) / 2;
+            if (ramps_distance(mid) > distance) {
+                hi = mid;
+            } else {
+                lo = mid;
+            }
+        }
+        v_peak = lo;
+    }
+    peak_speed = v_peak;
+    this->entry_speed = v_entry;
+    this->exit_speed = v_exit;
+    cruise = toNanoseconds(step_length / v_peak);
+
+    if (v_peak > v_entry) {
+        accel = rampIntervals(
+            Ramp(v_entry, v_peak, limits.acceleration, limits.jerk),
+            step_length, steps);
+    }
+    if (v_peak > v_exit) {
+        // Deceleration is stored as acceleration from exit speed
+        decel = rampIntervals(
+            Ramp(v_exit, v_peak, limits.acceleration, limits.jerk),
+            step_length, steps - accel.size());
+    }
+}
+
+uint64_t StepProfile::size() const { return steps; }
+
+nanoseconds StepProfile::interval(const uint64_t step) const {
+    if (step < accel.size()) {
+        return accel[step];
+    }
+    if (step >= steps - decel.size()) {
+        return decel[steps - 1 - step];
+    }
+    return cruise;
+}
+
+nanoseconds StepProfile::duration() const {
+    nanoseconds total{0};
+    for (const auto& dt : accel) {
+        total += dt;
+    }
+    for (const auto& dt : decel) {
+        total += dt;
+    }
+    return total + (steps - accel.size() - decel.size()) * cruise;
+}
+
+double StepProfile::peakSpeed() const { return peak_speed; }
+
+double StepProfile::entrySpeed() const { return entry_speed; }
+
+double StepProfile::exitSpeed() const { return exit_speed; }
+
+TEST_CASE("StepProfile") {
+    const double step_length = 0.01;
+    const ProfileLimits trapezoid{30.0, 600.0, 100.0};
+
+    SUBCASE("Constant speed") {
+        StepProfile p(1000, step_length, {100.0, 100.0, 100.0});
+        for (uint64_t i = 0; i < p.size(); i++) {
+            REQUIRE(p.interval(i) == 100us);
+        }
+        CHECK(p.duration() == 100ms);
+    }
+
+    SUBCASE("Symmetric") {
+        StepProfile p(12345, step_length, trapezoid);
+        for (uint64_t i = 0; i < p.size(); i++) {
+            REQUIRE(p.interval(i) == p.interval(p.size() - 1 - i));
+        }
+    }
+
+    SUBCASE("Trapezoid duration") {
+        // 5 m move, long enough to reach full speed
+        StepProfile p(500000, step_length, trapezoid);
+        const double t_accel = (600.0 - 30.0) / 100.0;
+        const double s_accel = (30.0 + 600.0) / 2 * t_accel;
+        const double expected = 2 * t_accel + (5000.0 - 2 * s_accel) / 600.0;
+        CHECK(p.peakSpeed() == doctest::Approx(600.0));
+        CHECK(duration<double>(p.duration()).count() ==
+              doctest::Approx(expected).epsilon(1e-3));
+    }
+
+    SUBCASE("Short move doesn't reach full speed") {
+        StepProfile p(10000, step_length, trapezoid);
+        // v^2 = v_0^2 + 2 * a * S / 2
+        CHECK(p.peakSpeed() ==
+              doctest::Approx(std::sqrt(30.0 * 30.0 + 100.0 * 100.0)));
+        for (uint64_t i = 1; i < p.size() / 2; i++) {
+            REQUIRE(p.interval(i) <= p.interval(i - 1));
+        }
+    }
+
+    SUBCASE("S-curve") {
+        ProfileLimits s_curve = trapezoid;
+        s_curve.jerk = 200.0;
+        StepProfile trapezoidal(500000, step_length, trapezoid);
+        StepProfile smooth(500000, step_length, s_curve);
+        CHECK(smooth.peakSpeed() == doctest::Approx(600.0));
+        CHECK(smooth.duration() > trapezoidal.duration());
+        // Starts slower than trapezoid, since acceleration rises gradually
+        CHECK(smooth.interval(1) > trapezoidal.interval(1));
+    }
+
+    SUBCASE("Entry and exit speeds") {
+        StepProfile p(10000, step_length, trapezoid, 100.0, 50.0);
+        // First and last steps are made at about entry and exit speeds
+        CHECK(duration<double>(p.interval(0)).count() ==
+              doctest::Approx(step_length / 100.0).epsilon(1e-2));
+        CHECK(duration<double>(p.interval(p.size() - 1)).count() ==
+              doctest::Approx(step_length / 50.0).epsilon(1e-2));
+        CHECK(p.duration() <
+              StepProfile(10000, step_length, trapezoid).duration());
+    }
+
+    SUBCASE("Reachable speed") {
+        CHECK(reachableSpeed(0, 100.0, trapezoid) ==
+              doctest::Approx(std::sqrt(30.0 * 30.0 + 2 * 100.0 * 100.0)));
+        CHECK(reachableSpeed(0, 1e6, trapezoid) == 600.0);
+        CHECK(rampDistance(600.0, 30.0, trapezoid) ==
+              doctest::Approx(rampDistance(30.0, 600.0, trapezoid)));
+    }
+
+    SUBCASE("Empty move") {
+        StepProfile p(0, step_length, trapezoid);
+        CHECK(p.size() == 0);
+        CHECK(p.duration() == 0ns);
+    }
+}
+
+}  // namespace pawnshop
@@ -1,10 +1,6 @@
 #include "pawnshop/motor.hpp"
 
 #include <chrono>
-#include <cmath>
-#include <map>
-#include <thread>
-#include <vector>
 
 using namespace std;
 using namespace std::chrono_literals;
@@ -17,70 +13,29 @@ MotorConfig::MotorConfig(const toml::table& table) {
     counter_clockwire = table["counter_clockwise"].value<bool>().value();
 }
 
-Motor::Motor(gpiod::line clock_line, gpiod::line dir_line,
+Motor::Motor(shared_ptr<StepBus> bus, const size_t channel,
              bool inverted /* = false */
              )
-    : inverted(inverted) {
-    static const gpiod::line_request output_req = {
-        "pawnshop-motor", gpiod::line_request::DIRECTION_OUTPUT, 0};
-    clock_line.request(output_req);
-    this->clock_line = clock_line;
-    dir_line.request(output_req);
-    this->dir_line = dir_line;
+    : bus(std::move(bus)), channel(channel), inverted(inverted) {
     setDirection(POSITIVE);
 }
 
-Motor::Motor(const gpiod::chip gpio_chip, const size_t clock_line_offset,
-             const size_t dir_line_offset, bool inverted /* = false */
-             )
-    : Motor(gpio_chip.get_line(clock_line_offset),
-            gpio_chip.get_line(dir_line_offset), inverted) {}
-
-Motor::Motor(gpiod::chip chip, const std::unique_ptr<MotorConfig> conf)
-    : Motor{chip, conf->clock_pin, conf->direction_pin,
-            conf->counter_clockwire} {}
+Motor::Motor(shared_ptr<StepBus> bus, const size_t channel,
+             const unique_ptr<MotorConfig> conf)
+    : Motor{std::move(bus), channel, conf->counter_clockwire} {}
 
 Motor::Motor(Motor&& src)
-    : clock_line(std::move(src.clock_line)),
-      dir_line(std::move(src.dir_line)),
+    : bus(std::move(src.bus)),
+      channel(src.channel),
       dir(src.dir),
-      inverted(src.inverted),
-      stopped(src.stopped),
-      period(src.period.load()) {}
-
-int16_t Motor::step() const {
-    if (stopped) {
-        return 0;
-    }
-    auto period = this->period.load();
-    clock_line.set_value(1);
-    std::this_thread::sleep_for(period / 2);
-    clock_line.set_value(0);
-    std::this_thread::sleep_for(period / 2);
-    return static_cast<int16_t>(dir);
-}
-
-void Motor::setFrequency(const uint32_t hz) {
-    if (hz == 0) {
-        stopped = true;
-        return;
-    }
-    stopped = false;
-    auto period = std::chrono::duration_cast<std::chrono::nanoseconds>(1s) / hz;
-    setPeriod(period);
-}
-
-int32_t Motor::getFrequency() const {
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(1s) /
-           period.load();
-}
+      inverted(src.inverted) {}
 
-void Motor::setPeriod(const std::chrono::nanoseconds period) {
-    this->period = period;
+StepBus::Mask Motor::getClockMask() const {
+    return StepBus::Mask{1} << channel;
 }
 
 void Motor::setDirection(Motor::Direction dir) {
-    dir_line.set_value(((dir == POSITIVE) ^ inverted) ? 1 : 0);
+    bus->setDirection(channel, (dir == POSITIVE) ^ inverted);
     this->dir = dir;
 }
 
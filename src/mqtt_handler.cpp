@@ -53,6 +53,7 @@ void MqttHandler::connected(const std::string& cause) {
     mqtt->subscribe("PawnShop/controller/move", QOS);
     mqtt->subscribe("PawnShop/controller/calibrate", QOS);
     mqtt->subscribe("PawnShop/controller/calibration/accept", QOS);
+    mqtt->subscribe("PawnShop/controller/stop", QOS);
 }
 
 // Called on arrival of message on any of topics we subscribed to
@@ -0,0 +1,133 @@
+#include "pawnshop/path_planner.hpp"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+using namespace pawnshop::vec;
+
+namespace pawnshop {
+
+/**
+ * Liang-Barsky clipping of path projection to XY plane
+ *
+ * @returns True if XY projection of segment crosses the box
+ */
+inline bool crosses(const Vec3D& from, const Vec3D& to,
+                    const BoundingBox& box) {
+    double t_in = 0, t_out = 1;
+    for (size_t i = 0; i < 2; i++) {
+        const double d = to[i] - from[i];
+        if (d == 0) {
+            if (from[i] < box.min[i] || from[i] > box.max[i]) {
+                return false;
+            }
+            continue;
+        }
+        double t_min = (box.min[i] - from[i]) / d;
+        double t_max = (box.max[i] - from[i]) / d;
+        if (t_min > t_max) {
+            std::swap(t_min, t_max);
+        }
+        t_in = std::max(t_in, t_min);
+        t_out = std::min(t_out, t_max);
+        if (t_in > t_out) {
+            return false;
+        }
+    }
+    return true;
+}
+
+PathPlanner::PathPlanner(optional<vector<BoundingBox>> boxes,
+                         const double safe_height)
+    : boxes(std::move(boxes)), safe_height(safe_height) {}
+
+double PathPlanner::passingHeight(const Vec3D& from, const Vec3D& to) const {
+    if (!boxes) {
+        return safe_height;
+    }
+    double height = 0;
+    for (const auto& box : *boxes) {
+        if (crosses(from, to, box)) {
+            height = std::max(height, box.max[2] + box.clearance);
+        }
+    }
+    // Safe height is free of collisions by definition
+    return std::min(height, safe_height);
+}
+
+vector<Vec3D> PathPlanner::route(const Vec3D& from, const Vec3D& to) const {
+    if (from[0] == to[0] && from[1] == to[1]) {
+        return {to};
+    }
+    const double height = passingHeight(from, to);
+    vector<Vec3D> path;
+    // Path above passing height is free, so the carriage moves diagonally
+    // whenever one of the ends is already high enough
+    if (from[2] < height) {
+        path.push_back({from[0], from[1], height});
+    }
+    if (to[2] < height) {
+        path.push_back({to[0], to[1], height});
+    }
+    path.push_back(to);
+    return path;
+}
+
+Vec3D PathPlanner::above(const Vec3D& coord) const {
+    return {coord[0], coord[1],
+            std::max(coord[2], passingHeight(coord, coord))};
+}
+
+TEST_CASE("PathPlanner") {
+    const double safe_height = 150;
+    // Two low devices and a tall one between them along X
+    const vector<BoundingBox> boxes{
+        {{0, 0, 0}, {50, 50, 40}, 10},
+        {{200, 0, 0}, {250, 50, 60}, 10},
+        {{100, 0, 0}, {150, 50, 120}, 10},
+    };
+    const PathPlanner planner(boxes, safe_height);
+
+    SUBCASE("Passes over the highest box under the path") {
+        auto path = planner.route({25, 25, 20}, {225, 25, 30});
+        REQUIRE(path.size() == 3);
+        CHECK(path[0] == Vec3D{25, 25, 130});
+        CHECK(path[1] == Vec3D{225, 25, 130});
+        CHECK(path[2] == Vec3D{225, 25, 30});
+    }
+
+    SUBCASE("Avoids climbing over boxes aside the path") {
+        auto path = planner.route({25, 25, 20}, {25, 200, 20});
+        REQUIRE(path.size() == 3);
+        CHECK(path[0][2] == 50);
+    }
+
+    SUBCASE("Vertical move") {
+        auto path = planner.route({25, 25, 20}, {25, 25, 45});
+        REQUIRE(path.size() == 1);
+    }
+
+    SUBCASE("Moves diagonally from above") {
+        auto path = planner.route({25, 25, 140}, {225, 25, 30});
+        REQUIRE(path.size() == 2);
+        CHECK(path[0] == Vec3D{225, 25, 130});
+    }
+
+    SUBCASE("Above device") {
+        CHECK(planner.above({225, 25, 30}) == Vec3D{225, 25, 70});
+        CHECK(planner.above({500, 500, 30}) == Vec3D{500, 500, 30});
+    }
+
+    SUBCASE("Unknown layout") {
+        const PathPlanner blind({}, safe_height);
+        auto path = blind.route({25, 25, 20}, {25, 200, 20});
+        REQUIRE(path.size() == 3);
+        CHECK(path[0][2] == safe_height);
+        CHECK(blind.above({225, 25, 30})[2] == safe_height);
+    }
+}
+
+}  // namespace pawnshop
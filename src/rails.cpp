@@ -1,11 +1,15 @@
 #include "pawnshop/rails.hpp"
 
+#include <doctest/doctest.h>
+#include <toml++/toml.h>
+
 #include <chrono>
 #include <cmath>
-#include <functional>
-#include <iostream>
+#include <stdexcept>
 #include <thread>
 
+#include "pawnshop/sim_gpio.hpp"
+
 using namespace std;
 using namespace std::chrono_literals;
 using namespace pawnshop::vec;
@@ -14,37 +18,345 @@ namespace pawnshop {
 
 RailsConfig::RailsConfig(const toml::table &table) {
     gpio_chip = table["gpio_chip"].value<string>().value();
+    backend = table["backend"].value_or("gpiod");
+    direction_setup =
+        chrono::microseconds(table["direction_setup"].value_or(5u));
 
     axes[0] = make_unique<AxisConfig>(*table["x_axis"].as_table());
     axes[1] = make_unique<AxisConfig>(*table["y_axis"].as_table());
     axes[2] = make_unique<AxisConfig>(*table["z_axis"].as_table());
+
+    std::array<bool, 3> listed{};
+    if (auto order = table["homing_order"].as_array()) {
+        for (auto &group_node : *order) {
+            vector<size_t> group;
+            for (auto &name : *group_node.as_array()) {
+                const auto axis = name.value<string>().value();
+                if (axis != "x" && axis != "y" && axis != "z") {
+                    throw invalid_argument("Unknown axis in homing_order: " +
+                                           axis);
+                }
+                group.push_back(axis[0] - 'x');
+                listed[group.back()] = true;
+            }
+            homing_order.push_back(group);
+        }
+    }
+    vector<size_t> rest;
+    for (size_t i = 0; i < listed.size(); i++) {
+        if (!listed[i]) {
+            rest.push_back(i);
+        }
+    }
+    if (!rest.empty()) {
+        homing_order.push_back(rest);
+    }
+}
+
+/**
+ * @returns Backend selected in config
+ */
+inline shared_ptr<gpio::Backend> makeBackend(const RailsConfig &conf) {
+    if (conf.backend == "gpiod") {
+        return make_shared<gpio::GpiodBackend>(conf.gpio_chip);
+    }
+    if (conf.backend == "simulated") {
+        return make_shared<gpio::SimulatedBackend>(conf);
+    }
+    throw invalid_argument("Unknown GPIO backend: " + conf.backend);
+}
+
+Rails::Rails(const std::unique_ptr<RailsConfig> conf,
+             unique_ptr<RealtimeConfig> realtime /* = nullptr */)
+    : backend(makeBackend(*conf)), realtime(std::move(realtime)) {
+    setup(*conf);
+}
+
+Rails::Rails(const std::unique_ptr<RailsConfig> conf,
+             shared_ptr<gpio::Backend> backend,
+             unique_ptr<RealtimeConfig> realtime /* = nullptr */)
+    : backend(std::move(backend)), realtime(std::move(realtime)) {
+    setup(*conf);
 }
 
-Rails::Rails(const std::unique_ptr<RailsConfig> conf) : chip{conf->gpio_chip} {
+void Rails::setup(RailsConfig &conf) {
+    homing_order = conf.homing_order;
+    vector<size_t> clock_pins, dir_pins;
+    for (const auto &axis : conf.axes) {
+        clock_pins.push_back(axis->motor->clock_pin);
+        dir_pins.push_back(axis->motor->direction_pin);
+    }
+    bus = make_shared<StepBus>(*backend, clock_pins, dir_pins,
+                               conf.direction_setup);
     for (size_t i = 0; i < axes.size(); i++) {
-        axes[i] = make_unique<Axis>(chip, std::move(conf->axes[i]));
+        axes[i] =
+            make_unique<Axis>(*backend, bus, i, std::move(conf.axes[i]));
     }
+    stepper = std::thread(&Rails::runTasks, this);
 }
 
-void Rails::move(Vec3D newPos) {
-    const Vec3D track = newPos - getPos();
-    const Vec3D direction = normalize(track);
-    std::array<std::thread, 3> movingAxes;
-    for (size_t i = 0; i < movingAxes.size(); i++) {
-        movingAxes[i] =
-            std::thread(&Axis::move, axes[i].get(), newPos[i], direction[i]);
+Rails::~Rails() {
+    {
+        std::lock_guard lk(tasks_mx);
+        stopping = true;
     }
-    for (auto &t : movingAxes) {
-        t.join();
+    tasks_cv.notify_all();
+    stepper.join();
+}
+
+std::future<void> Rails::schedule(std::function<void()> task) {
+    std::packaged_task<void()> packaged(std::move(task));
+    auto result = packaged.get_future();
+    {
+        std::lock_guard lk(tasks_mx);
+        tasks.push_back(std::move(packaged));
     }
+    tasks_cv.notify_one();
+    return result;
 }
 
-void Rails::calibrate() {
-    for (auto &axis : axes) {
-        axis->calibrate();
+void Rails::runTasks() {
+    if (realtime) {
+        setupRealtime(*realtime);
+    }
+    // Wake-up latency depends on scheduling policy and CPU of this thread
+    timer.calibrate();
+    while (true) {
+        std::packaged_task<void()> task;
+        {
+            std::unique_lock lk(tasks_mx);
+            tasks_cv.wait(lk, [this]() { return stopping || !tasks.empty(); });
+            if (stopping) {
+                return;
+            }
+            task = std::move(tasks.front());
+            tasks.pop_front();
+        }
+        task();
+    }
+}
+
+void Rails::move(Vec3D newPos, const CancellationToken &cancel) {
+    moveAsync(newPos, cancel).get();
+}
+
+void Rails::move(const vector<Vec3D> &waypoints,
+                 const CancellationToken &cancel) {
+    moveAsync(waypoints, cancel).get();
+}
+
+future<void> Rails::moveAsync(const Vec3D newPos,
+                              const CancellationToken &cancel) {
+    return moveAsync(vector<Vec3D>{newPos}, cancel);
+}
+
+future<void> Rails::moveAsync(const vector<Vec3D> &waypoints,
+                              const CancellationToken &cancel) {
+    return schedule([this, waypoints, cancel]() {
+        cancel.throwIfCancelled();
+        if (!calibrated) {
+            throw runtime_error("Rails are not calibrated");
+        }
+        followPath(waypoints, cancel);
+    });
+}
+
+future<void> Rails::whenIdle() {
+    return schedule([]() {});
+}
+
+RailsKinematics Rails::getKinematics() const {
+    RailsKinematics kinematics;
+    for (size_t i = 0; i < axes.size(); i++) {
+        kinematics[i] = {axes[i]->getStepLength(), axes[i]->getLimits()};
+    }
+    return kinematics;
+}
+
+void Rails::followPath(const vector<Vec3D> &waypoints,
+                       const CancellationToken &cancel) {
+    const RailsKinematics kinematics = getKinematics();
+    const auto path =
+        planPath(kinematics, toSteps(kinematics, getPos()), waypoints);
+    // Segments share one timeline, so there are no gaps at junctions
+    timer.start();
+    optional<double> braking;
+    for (size_t k = 0; k < path.size(); k++) {
+        const auto &segment = path[k];
+        if (!executeSegment(segment, cancel, braking)) {
+            throw OperationCancelled();
+        }
+        // Profiles end at min_speed, so carriage rests for one more step
+        // interval at stops before it starts in the new direction
+        if (segment.exit_speed == 0 && k + 1 < path.size()) {
+            timer.sleep(chrono::duration_cast<chrono::nanoseconds>(
+                chrono::duration<double>(segment.length / segment.ticks /
+                                         segment.limits.min_speed)));
+        }
+    }
+}
+
+bool Rails::executeSegment(const Segment &segment,
+                           const CancellationToken &cancel,
+                           optional<double> &braking) {
+    const StepProfile profile = segment.profile();
+    // mm along path per tick
+    const double tick_length = profile.size() == 0
+                                   ? 0
+                                   : segment.length / profile.size();
+    std::array<uint64_t, 3> error;
+    for (size_t i = 0; i < axes.size(); i++) {
+        error[i] = segment.ticks / 2;
+        if (segment.steps[i] != 0) {
+            axes[i]->setDirection(segment.steps[i] > 0 ? Motor::POSITIVE
+                                                       : Motor::NEGATIVE);
+        }
+    }
+    for (uint64_t tick = 0; tick < profile.size(); tick++) {
+        auto period = profile.interval(tick);
+        // Checked every tick, so braking starts within a step. Ramp is
+        // trapezoidal even with jerk limiting, to stop as soon as possible.
+        if (cancel.cancelled()) {
+            const double planned =
+                tick_length / chrono::duration<double>(period).count();
+            double speed = planned;
+            if (braking) {
+                const double v2 = *braking * *braking -
+                                  2 * segment.limits.acceleration * tick_length;
+                // Planned speed is lower ahead of sharp junctions
+                speed = std::min(std::sqrt(std::max(v2, 0.0)), planned);
+            }
+            braking = speed;
+            if (speed <= segment.limits.min_speed) {
+                return false;
+            }
+            period = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::duration<double>(tick_length / speed));
+        }
+        // Edges of all axes stepping on this tick are written at once
+        StepBus::Mask stepping = 0;
+        for (size_t i = 0; i < axes.size(); i++) {
+            error[i] += std::abs(segment.steps[i]);
+            if (error[i] >= segment.ticks) {
+                error[i] -= segment.ticks;
+                if (axes[i]->advance()) {
+                    stepping |= axes[i]->getClockMask();
+                }
+            }
+        }
+        bus->setClocks(stepping, true);
+        // Ticks where axes refuse to step don't count in jitter
+        if (stepping != 0) {
+            timer.recordStep();
+        }
+        timer.sleep(period / 2);
+        bus->setClocks(stepping, false);
+        timer.sleep(period - period / 2);
+    }
+    return true;
+}
+
+void Rails::calibrate(const CancellationToken &cancel) {
+    calibrateAsync(cancel).get();
+}
+
+future<void> Rails::calibrateAsync(const CancellationToken &cancel) {
+    return schedule([this, cancel]() {
+        // Homing moves axes without tracking position
+        const bool position_known = calibrated;
+        calibrated = false;
+        for (const auto &group : homing_order) {
+            cancel.throwIfCancelled();
+            homeGroup(group, position_known, cancel);
+        }
+        calibrated = true;
+    });
+}
+
+void Rails::homeGroup(const vector<size_t> &group, const bool position_known,
+                      const CancellationToken &cancel) {
+    struct Homed {
+        size_t axis;
+        Axis::Homing homing;
+        // Since start of the group
+        chrono::nanoseconds due;
+        // Until the next step
+        chrono::nanoseconds interval;
+        // Speed once cancelled
+        optional<double> braking;
+        bool done;
+    };
+    vector<Homed> homed;
+    for (const size_t i : group) {
+        homed.push_back(
+            {i, Axis::Homing(*axes[i], position_known), 0ns, 0ns, {}, false});
+    }
+    size_t active = homed.size();
+    timer.start();
+    chrono::nanoseconds now{0};
+    while (true) {
+        StepBus::Mask stepping = 0;
+        for (auto &h : homed) {
+            if (h.done || h.due > now) {
+                continue;
+            }
+            Axis &axis = *axes[h.axis];
+            optional<chrono::nanoseconds> interval;
+            if (!cancel.cancelled()) {
+                interval = h.homing.next();
+            } else {
+                // Same ramp as a cancelled move, from speed of last step
+                const auto limits = axis.getLimits();
+                const double step = axis.getStepLength();
+                double speed =
+                    h.interval > 0ns
+                        ? step / chrono::duration<double>(h.interval).count()
+                        : 0;
+                if (h.braking) {
+                    const double v2 = *h.braking * *h.braking -
+                                      2 * limits.acceleration * step;
+                    speed = std::sqrt(std::max(v2, 0.0));
+                }
+                h.braking = speed;
+                if (speed > limits.min_speed && axis.advance()) {
+                    interval = chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::duration<double>(step / speed));
+                }
+            }
+            if (interval) {
+                stepping |= axis.getClockMask();
+                h.interval = *interval;
+                h.due = now + *interval;
+            } else {
+                h.done = true;
+                active--;
+            }
+        }
+        if (active == 0) {
+            cancel.throwIfCancelled();
+            return;
+        }
+        auto next = chrono::nanoseconds::max();
+        for (const auto &h : homed) {
+            if (!h.done) {
+                next = std::min(next, h.due);
+            }
+        }
+        // Clock lines go low halfway to the next step of any axis
+        const auto period = next - now;
+        bus->setClocks(stepping, true);
+        if (stepping != 0) {
+            timer.recordStep();
+        }
+        timer.sleep(period / 2);
+        bus->setClocks(stepping, false);
+        timer.sleep(period - period / 2);
+        now = next;
     }
 }
 
+const JitterHistogram &Rails::getJitter() const { return timer.jitter(); }
+
 Vec3D Rails::getPos() {
     Vec3D pos;
     auto i = pos.begin();
@@ -54,4 +366,197 @@ Vec3D Rails::getPos() {
     return pos;
 }
 
+TEST_CASE("Rails on simulated backend") {
+    const auto table = toml::parse(R"(
+        gpio_chip = ''
+        backend = 'simulated'
+        homing_order = [['z'], ['x', 'y']]
+        [x_axis]
+        length = 100.0
+        steps = 10000
+        min_speed = 10.0
+        max_speed = 100.0
+        acceleration = 1000.0
+        [x_axis.motor]
+        clock_pin = 1
+        direction_pin = 2
+        counter_clockwise = false
+        [x_axis.limit_switches.negative]
+        pin = 3
+        [x_axis.homing]
+        backoff = 1.0
+        overtravel = 5.0
+        [y_axis]
+        length = 100.0
+        steps = 10000
+        min_speed = 10.0
+        max_speed = 100.0
+        acceleration = 1000.0
+        [y_axis.motor]
+        clock_pin = 4
+        direction_pin = 5
+        counter_clockwise = true
+        [y_axis.limit_switches.negative]
+        pin = 6
+        [y_axis.homing]
+        backoff = 1.0
+        overtravel = 5.0
+        [z_axis]
+        length = 50.0
+        steps = 10000
+        min_speed = 5.0
+        max_speed = 50.0
+        acceleration = 500.0
+        [z_axis.motor]
+        clock_pin = 7
+        direction_pin = 8
+        counter_clockwise = false
+        [z_axis.limit_switches.negative]
+        pin = 9
+        [z_axis.homing]
+        backoff = 1.0
+        overtravel = 2.5
+    )");
+    auto conf = make_unique<RailsConfig>(table);
+    auto sim = make_shared<gpio::SimulatedBackend>(*conf);
+    // Switches are approached at max_speed, X takes 0.1s to reach it
+    sim->setPosition(0, 1000);
+    sim->setPosition(1, 100);
+    sim->setPosition(2, 100);
+    Rails rails(std::move(conf), sim);
+
+    const auto homing_start = chrono::steady_clock::now();
+    rails.calibrate();
+    CHECK(chrono::steady_clock::now() - homing_start < 5s);
+    for (size_t i = 0; i < 3; i++) {
+        CHECK(sim->getPosition(i) == 0);
+        CHECK(sim->getStalls(i) == 0);
+    }
+    // Z is homed first, then X and Y together
+    array<gpio::SimulatedBackend::Edge, 3> first{}, last{};
+    for (const auto &edge : sim->takeEdges()) {
+        const size_t axis = (edge.pin - 1) / 3;
+        if ((edge.pin - 1) % 3 == 0 && edge.high) {
+            if (first[axis].pin == 0) {
+                first[axis] = edge;
+            }
+            last[axis] = edge;
+        }
+    }
+    CHECK(last[2].time < first[0].time);
+    CHECK(last[2].time < first[1].time);
+    CHECK(first[0].time < last[1].time);
+    CHECK(first[1].time < last[0].time);
+    CHECK(rails.getPos() == Vec3D{0, 0, 0});
+
+    SUBCASE("Move accuracy") {
+        rails.move(Vec3D{5, 2.5, 1});
+        CHECK(sim->getPosition(0) == 500);
+        CHECK(sim->getPosition(1) == 250);
+        CHECK(sim->getPosition(2) == 200);
+        rails.move({{10, 0, 1}, {1, 1, 2}});
+        CHECK(sim->getPosition(0) == 100);
+        CHECK(sim->getPosition(1) == 100);
+        CHECK(sim->getPosition(2) == 400);
+        for (size_t i = 0; i < 3; i++) {
+            CHECK(sim->getStalls(i) == 0);
+        }
+        const Vec3D pos = rails.getPos();
+        CHECK(pos[0] == doctest::Approx(1));
+        CHECK(pos[1] == doctest::Approx(1));
+        CHECK(pos[2] == doctest::Approx(2));
+    }
+
+    SUBCASE("Motion timing") {
+        sim->takeEdges();
+        rails.move(Vec3D{5, 0, 0});
+        vector<gpio::SimulatedBackend::Edge> edges;
+        for (const auto &edge : sim->takeEdges()) {
+            if (edge.pin == 1) {
+                edges.push_back(edge);
+            }
+        }
+        REQUIRE(edges.size() == 1000);
+        // Profile of a single axis move is planned by the axis alone
+        const StepProfile profile(500, 0.01, {10.0, 100.0, 1000.0});
+        const auto span = edges.back().time - edges.front().time;
+        CHECK(span >= profile.duration() - profile.interval(499));
+        CHECK(span < profile.duration() * 2);
+    }
+
+    SUBCASE("Two-phase homing beats crawling") {
+        // Crawling to the switches at min_speed would take 8s
+        sim->setPosition(0, 8000);
+        sim->setPosition(1, 8000);
+        const auto start = chrono::steady_clock::now();
+        rails.calibrate();
+        // About 1s as planned, bound only catches a crawl
+        CHECK(chrono::steady_clock::now() - start < 4s);
+        for (size_t i = 0; i < 3; i++) {
+            CHECK(sim->getPosition(i) == 0);
+            CHECK(sim->getStalls(i) == 0);
+        }
+    }
+
+    SUBCASE("Cancelled homing ramps down") {
+        // X cruises at 100mm/s from 75mm on
+        sim->setPosition(0, 8000);
+        const CancellationToken cancel;
+        auto homing = rails.calibrateAsync(cancel);
+        while (sim->getPosition(0) > 7000) {
+            this_thread::sleep_for(1ms);
+        }
+        const int64_t cancelled_at = sim->getPosition(0);
+        cancel.cancel();
+        CHECK_THROWS_AS(homing.get(), OperationCancelled);
+        // Ramp to min_speed is 4.95mm long, position was read before
+        // cancelling. Upper bound leaves room for this thread being held up.
+        const int64_t stopped_at = sim->getPosition(0);
+        CHECK(cancelled_at - stopped_at >= 490);
+        CHECK(cancelled_at - stopped_at < 2000);
+        CHECK(stopped_at > 0);
+        CHECK(sim->getStalls(0) == 0);
+        // Position is unknown until homed again
+        CHECK_THROWS_AS(rails.move(Vec3D{1, 0, 0}), runtime_error);
+
+        rails.calibrate();
+        rails.move(Vec3D{1, 0, 0});
+        CHECK(sim->getPosition(0) == 100);
+    }
+
+    SUBCASE("Stops at limit switch") {
+        rails.move(Vec3D{-1, 0, 0});
+        CHECK(sim->getStalls(0) == 0);
+        CHECK(rails.getPos()[0] == 0);
+    }
+
+    SUBCASE("Cancelled move ramps down") {
+        const CancellationToken cancel;
+        auto moving = rails.moveAsync(Vec3D{90, 0, 0}, cancel);
+        // Cruising at max_speed by then
+        this_thread::sleep_for(300ms);
+        const double cancelled_at = rails.getPos()[0];
+        const auto start = chrono::steady_clock::now();
+        cancel.cancel();
+        CHECK_THROWS_AS(moving.get(), OperationCancelled);
+        // Ramp from max_speed to min_speed takes 90ms, bound only catches
+        // a move that doesn't stop
+        CHECK(chrono::steady_clock::now() - start < 5s);
+
+        // Ramp is (100^2 - 10^2) / (2 * 1000) mm long. Position was read
+        // before cancelling, so carriage went at least that far. Positions
+        // don't depend on timing of stepping thread, unlike step intervals.
+        const double stopped_at = rails.getPos()[0];
+        CHECK(stopped_at - cancelled_at > 4.9);
+        // Leaves room for this thread being held up before cancelling
+        CHECK(stopped_at - cancelled_at < 20.0);
+
+        // Token stays cancelled, so moves using it are skipped
+        CHECK_THROWS_AS(rails.move(Vec3D{0, 0, 0}, cancel),
+                        OperationCancelled);
+        CHECK(rails.getPos()[0] == stopped_at);
+        CHECK(sim->getStalls(0) == 0);
+    }
+}
+
 }  // namespace pawnshop
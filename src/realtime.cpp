@@ -0,0 +1,88 @@
+#include "pawnshop/realtime.hpp"
+
+#include <alloca.h>
+#include <fmt/format.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+namespace pawnshop {
+
+RealtimeConfig::RealtimeConfig(const toml::table& table) {
+    priority = table["priority"].value_or(0);
+    if (auto value = table["cpu"].value<size_t>()) {
+        cpu = value;
+    }
+    if (priority > 0 && !cpu) {
+        throw invalid_argument(
+            "Real-time priority requires the thread to be pinned to a cpu");
+    }
+    lock_memory = table["lock_memory"].value_or(false);
+    stack_prefault = table["stack_prefault"].value_or(size_t{0});
+}
+
+inline void prefaultStack(const size_t size) {
+    const size_t page = sysconf(_SC_PAGESIZE);
+    auto stack = static_cast<volatile char*>(alloca(size));
+    for (size_t i = 0; i < size; i += page) {
+        stack[i] = 0;
+    }
+}
+
+void setupRealtime(const RealtimeConfig& conf) {
+    string scheduling = "default scheduling";
+    if (conf.priority > 0) {
+        sched_param param{};
+        param.sched_priority = conf.priority;
+        const int err =
+            pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err == 0) {
+            scheduling = fmt::format("SCHED_FIFO priority {}", conf.priority);
+        } else {
+            spdlog::warn("Failed to set SCHED_FIFO priority {}: {}",
+                         conf.priority, strerror(err));
+        }
+    }
+
+    string affinity = "any CPU";
+    if (conf.cpu) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(*conf.cpu, &cpus);
+        const int err =
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        if (err == 0) {
+            affinity = fmt::format("CPU {}", *conf.cpu);
+        } else {
+            spdlog::warn("Failed to pin thread to CPU {}: {}", *conf.cpu,
+                         strerror(err));
+        }
+    }
+
+    string memory = "memory not locked";
+    if (conf.lock_memory) {
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+            memory = "memory locked";
+        } else {
+            spdlog::warn("Failed to lock memory: {}", strerror(errno));
+        }
+    }
+    // Pages touched after mlockall stay resident
+    if (conf.stack_prefault > 0) {
+        prefaultStack(conf.stack_prefault);
+    }
+
+    spdlog::info("Real-time thread runs with {} on {}, {}", scheduling,
+                 affinity, memory);
+}
+
+}  // namespace pawnshop
@@ -0,0 +1,199 @@
+#include "pawnshop/robust_stats.hpp"
+
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <stdexcept>
+
+using namespace std;
+
+namespace pawnshop {
+
+// Ratio of standard deviation to MAD for normal distribution
+static constexpr double MAD_SCALE = 1.4826;
+// Ratio of standard errors of median and mean for normal distribution
+static constexpr double MEDIAN_EFFICIENCY = 1.2533;
+
+Estimator parseEstimator(const string& name) {
+    if (name == "mean") {
+        return Estimator::MEAN;
+    } else if (name == "median") {
+        return Estimator::MEDIAN;
+    } else if (name == "trimmed_mean") {
+        return Estimator::TRIMMED_MEAN;
+    } else if (name == "mad") {
+        return Estimator::MAD;
+    }
+    throw invalid_argument("Unknown estimator: " + name);
+}
+
+SlidingWindow::SlidingWindow(const size_t capacity) : capacity(capacity) {
+    if (capacity == 0) {
+        throw invalid_argument("Window capacity must be positive");
+    }
+    values.reserve(capacity);
+    sorted.reserve(capacity);
+}
+
+void SlidingWindow::push(const double value) {
+    if (full()) {
+        const double dropped = values[oldest];
+        sorted.erase(lower_bound(sorted.begin(), sorted.end(), dropped));
+        values[oldest] = value;
+        oldest = (oldest + 1) % capacity;
+    } else {
+        values.push_back(value);
+    }
+    sorted.insert(upper_bound(sorted.begin(), sorted.end(), value), value);
+}
+
+void SlidingWindow::clear() {
+    values.clear();
+    sorted.clear();
+    oldest = 0;
+}
+
+size_t SlidingWindow::size() const { return sorted.size(); }
+
+bool SlidingWindow::full() const { return sorted.size() == capacity; }
+
+double SlidingWindow::median() const {
+    const size_t n = sorted.size();
+    if (n == 0) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+double SlidingWindow::mad() const {
+    const size_t n = sorted.size();
+    if (n == 0) {
+        return numeric_limits<double>::quiet_NaN();
+    }
+    // Deviations grow outwards from median on both sides, so the middle
+    // ones are found by merging the two sides
+    const double m = median();
+    size_t right = lower_bound(sorted.begin(), sorted.end(), m) -
+                   sorted.begin();
+    size_t left = right;
+    double previous = 0, current = 0;
+    for (size_t i = 0; i <= n / 2; i++) {
+        previous = current;
+        if (right < n &&
+            (left == 0 || sorted[right] - m <= m - sorted[left - 1])) {
+            current = sorted[right++] - m;
+        } else {
+            current = m - sorted[--left];
+        }
+    }
+    return n % 2 ? current : (previous + current) / 2;
+}
+
+double SlidingWindow::trimmedMean(const double trim) const {
+    const size_t cut = sorted.size() * trim;
+    return rangeEstimate(cut, sorted.size() - cut).value;
+}
+
+StatEstimate SlidingWindow::estimate(const Estimator estimator,
+                                     const double trim,
+                                     const double mad_threshold) const {
+    const size_t n = sorted.size();
+    switch (estimator) {
+        case Estimator::MEAN:
+            return rangeEstimate(0, n);
+        case Estimator::MEDIAN:
+            return {median(), n > 1 ? MEDIAN_EFFICIENCY * MAD_SCALE * mad() /
+                                          sqrt(n)
+                                    : numeric_limits<double>::infinity()};
+        case Estimator::TRIMMED_MEAN: {
+            const size_t cut = n * trim;
+            return rangeEstimate(cut, n - cut);
+        }
+        case Estimator::MAD: {
+            const double m = median();
+            const double limit = mad_threshold * MAD_SCALE * mad();
+            const auto begin =
+                lower_bound(sorted.begin(), sorted.end(), m - limit);
+            const auto end = upper_bound(begin, sorted.end(), m + limit);
+            return rangeEstimate(begin - sorted.begin(), end - sorted.begin());
+        }
+    }
+    throw invalid_argument("Unknown estimator");
+}
+
+StatEstimate SlidingWindow::rangeEstimate(const size_t begin,
+                                          const size_t end) const {
+    const double n = end - begin;
+    if (n == 0) {
+        return {median(), numeric_limits<double>::infinity()};
+    }
+    double mean = 0;
+    for (size_t i = begin; i < end; i++) {
+        mean += sorted[i] / n;
+    }
+    if (n < 2) {
+        return {mean, numeric_limits<double>::infinity()};
+    }
+    double var = 0;
+    for (size_t i = begin; i < end; i++) {
+        var += (sorted[i] - mean) * (sorted[i] - mean);
+    }
+    return {mean, sqrt(var / (n - 1) / n)};
+}
+
+TEST_CASE("SlidingWindow") {
+    SUBCASE("Matches sorting of the window") {
+        mt19937 gen(7);
+        uniform_real_distribution<double> value(-5.0, 5.0);
+        for (const size_t capacity : {1, 7, 8}) {
+            SlidingWindow window(capacity);
+            vector<double> history;
+            for (int i = 0; i < 500; i++) {
+                // Repeated values check removal of duplicates
+                const double v = i % 5 == 0 ? 1.0 : value(gen);
+                window.push(v);
+                history.push_back(v);
+
+                const size_t n = std::min(history.size(), capacity);
+                vector<double> sorted(history.end() - n, history.end());
+                sort(sorted.begin(), sorted.end());
+                const double median =
+                    n % 2 ? sorted[n / 2]
+                          : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+                vector<double> deviations;
+                for (const double s : sorted) {
+                    deviations.push_back(abs(s - median));
+                }
+                sort(deviations.begin(), deviations.end());
+                const double mad =
+                    n % 2 ? deviations[n / 2]
+                          : (deviations[n / 2 - 1] + deviations[n / 2]) / 2;
+
+                REQUIRE(window.size() == n);
+                CHECK(window.median() == median);
+                CHECK(window.mad() == doctest::Approx(mad));
+            }
+        }
+    }
+    SUBCASE("Outliers") {
+        SlidingWindow window(10);
+        for (const double v :
+             {10.0, 10.1, 9.9, 10.0, 10.1, 9.9, 10.0, 10.0, 50.0, 0.0}) {
+            window.push(v);
+        }
+        CHECK(window.estimate(Estimator::MEAN, 0, 0).value ==
+              doctest::Approx(13.0));
+        CHECK(window.median() == 10.0);
+        CHECK(window.trimmedMean(0.1) == doctest::Approx(10.0));
+        const auto filtered = window.estimate(Estimator::MAD, 0, 3.0);
+        CHECK(filtered.value == doctest::Approx(10.0));
+        CHECK(filtered.uncertainty < 0.05);
+        CHECK(window.estimate(Estimator::MEDIAN, 0, 0).uncertainty < 0.1);
+    }
+    CHECK_THROWS_AS(parseEstimator("mode"), invalid_argument);
+}
+
+}  // namespace pawnshop
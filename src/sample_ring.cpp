@@ -0,0 +1,94 @@
+#include "pawnshop/sample_ring.hpp"
+
+#include <doctest/doctest.h>
+
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace pawnshop {
+
+void SampleRing::push(const ScaleSample& sample) {
+    const uint64_t index = head.load(memory_order_relaxed);
+    auto& slot = slots[index % CAPACITY];
+    slot.sequence.store(0);
+    slot.time.store(sample.time.time_since_epoch().count());
+    slot.weight.store(sample.weight);
+    slot.stable.store(sample.stable);
+    slot.container.store(sample.container);
+    slot.sequence.store(index + 1);
+    head.store(index + 1);
+}
+
+uint64_t SampleRing::end() const { return head.load(); }
+
+optional<ScaleSample> SampleRing::get(const uint64_t index) const {
+    const auto& slot = slots[index % CAPACITY];
+    if (slot.sequence.load() != index + 1) {
+        return {};
+    }
+    ScaleSample sample{steady_clock::time_point(
+                           steady_clock::duration(slot.time.load())),
+                       slot.weight.load(), slot.stable.load(),
+                       slot.container.load()};
+    // Writer clears sequence before touching fields
+    if (slot.sequence.load() != index + 1) {
+        return {};
+    }
+    return sample;
+}
+
+optional<ScaleSample> SampleRing::latest() const {
+    const uint64_t index = end();
+    if (index == 0) {
+        return {};
+    }
+    return get(index - 1);
+}
+
+TEST_CASE("SampleRing") {
+    auto ring = make_unique<SampleRing>();
+    CHECK(!ring->latest());
+
+    ring->push({steady_clock::time_point(1s), 1.5, true, false});
+    REQUIRE(ring->latest());
+    CHECK(ring->latest()->weight == 1.5);
+    CHECK(ring->latest()->stable);
+    CHECK(!ring->get(1));
+
+    SUBCASE("Overwritten samples are missing") {
+        for (size_t i = 0; i < SampleRing::CAPACITY; i++) {
+            ring->push({steady_clock::time_point(1s), 2.0, false, false});
+        }
+        CHECK(!ring->get(0));
+        CHECK(ring->get(1)->weight == 2.0);
+        CHECK(ring->end() == SampleRing::CAPACITY + 1);
+    }
+    SUBCASE("Reader never sees torn samples") {
+        const uint64_t count = 200000;
+        thread writer([&]() {
+            for (uint64_t i = 1; i <= count; i++) {
+                ring->push({steady_clock::time_point(nanoseconds(i)),
+                            double(i), i % 2 == 0, false});
+            }
+        });
+        bool torn = false;
+        while (ring->end() <= count) {
+            const auto index = ring->end() - 1;
+            for (uint64_t i = index; i + 8 > index && i > 0; i--) {
+                const auto sample = ring->get(i);
+                if (sample && (sample->weight != i ||
+                               sample->time != steady_clock::time_point(
+                                                   nanoseconds(i)) ||
+                               sample->stable != (i % 2 == 0))) {
+                    torn = true;
+                }
+            }
+        }
+        writer.join();
+        CHECK(!torn);
+    }
+}
+
+}  // namespace pawnshop
@@ -1,82 +1,273 @@
 #include "pawnshop/scales.hpp"
 
-#include <chrono>
-#include <iostream>
-#include <numeric>
-#include <regex>
+#include <doctest/doctest.h>
+#include <spdlog/spdlog.h>
 
-#include "pawnshop/util.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
 
 using namespace std;
+using namespace std::chrono;
 
 namespace pawnshop {
 
 ScalesConfig::ScalesConfig(const toml::table& table) {
-    uart_path = table["uart_path"].value<string>().value();
-    sample_size = table["sample_size"].value<size_t>().value_or(20);
+    serial = make_unique<SerialConfig>(table);
+    settling = make_unique<SettlingConfig>(table);
+}
+
+Scales::Subscription::Subscription(Scales& scales, const uint64_t id)
+    : scales(&scales), id(id) {}
+
+Scales::Subscription::Subscription(Subscription&& other)
+    : scales(other.scales), id(other.id) {
+    other.scales = nullptr;
+}
+
+Scales::Subscription::~Subscription() {
+    if (scales) {
+        lock_guard lk(scales->subscribers_mx);
+        scales->subscribers.erase(id);
+    }
+}
+
+Scales::Scales(unique_ptr<const ScalesConfig> conf)
+    : conf{move(conf)}, port{*this->conf->serial} {
+    reader = thread(&Scales::readSamples, this);
+}
+
+Scales::~Scales() {
+    {
+        lock_guard lk(line_mx);
+        running = false;
+    }
+    line_cv.notify_all();
+    reader.join();
+}
+
+const char* toString(const ScaleField field) {
+    switch (field) {
+        case ScaleField::NONE:
+            return "none";
+        case ScaleField::STABILITY:
+            return "stability";
+        case ScaleField::MODE:
+            return "mode";
+        case ScaleField::WEIGHT:
+            return "weight";
+        case ScaleField::UNIT:
+            return "unit";
+        case ScaleField::LENGTH:
+            return "length";
+    }
+    return "unknown";
+}
+
+/**
+ * Parses sign and 7 characters of digits, dots and spaces. Spaces are
+ * skipped and parsing stops at the second dot, same as stod does.
+ */
+inline bool parseWeight(const string_view field, double& weight) {
+    static constexpr double POW10[] = {1e0, 1e1, 1e2, 1e3,
+                                       1e4, 1e5, 1e6, 1e7};
+    if (field[0] != '-' && field[0] != ' ') {
+        return false;
+    }
+    uint32_t mantissa = 0;
+    size_t decimals = 0, dots = 0;
+    bool has_digits = false;
+    for (const char c : field.substr(1)) {
+        if (c == '.') {
+            dots++;
+        } else if (c >= '0' && c <= '9') {
+            if (dots < 2) {
+                mantissa = mantissa * 10 + (c - '0');
+                decimals += dots;
+                has_digits = true;
+            }
+        } else if (c != ' ') {
+            return false;
+        }
+    }
+    if (!has_digits) {
+        return false;
+    }
+    // Both are exact, so quotient is rounded the same way as by stod
+    weight = mantissa / POW10[decimals];
+    if (field[0] == '-') {
+        weight = -weight;
+    }
+    return true;
 }
 
-Scales::Scales(unique_ptr<const ScalesConfig> conf) : conf{move(conf)} {}
-
-Scales::~Scales() {}
-
-std::optional<Scales::State> Scales::parse(const std::string line) {
-    const std::regex entry_format(
-        "(ST|US),(GS|NT)([\\- ][0-9\\. ]{7})([a-z ]{3})",
-        std::regex_constants::ECMAScript | std::regex_constants::optimize);
-    std::smatch submatch;
-    Scales::State state;
-    if (!regex_match(line, submatch, entry_format)) {
-        return {};
-    }
-    auto sub_it = submatch.begin();
-    state.stable = *(++sub_it) == "ST";
-    state.container = *(++sub_it) != "GS";
-    std::string weight = *(++sub_it);
-    std::string weight_formatted;
-    copy_if(weight.begin(), weight.end(), back_inserter(weight_formatted),
-            [](const char c) { return !isspace(c); });
-    state.weight = stod(weight_formatted);
-    std::string unit = *(++sub_it);
-    unit.erase(unit.begin(), find_if(unit.begin(), unit.end(),
-                                     [](const char c) { return !isspace(c); }));
-    unit.erase(find_if(unit.begin(), unit.end(),
-                       [](const char c) { return isspace(c); }),
-               unit.end());
-    state.unit = unit;
-    return state;
+ParsedLine Scales::parse(const string_view line) {
+    static constexpr size_t MODE_POS = 2, WEIGHT_POS = 5, UNIT_POS = 13,
+                            LINE_SIZE = 16;
+    ParsedLine parsed{{}, ScaleField::NONE};
+    auto& reading = parsed.reading;
+    const auto fail = [&](const ScaleField field) {
+        parsed.error = field;
+        return parsed;
+    };
+
+    const auto stability = line.substr(0, MODE_POS);
+    if (stability != "ST" && stability != "US") {
+        return fail(ScaleField::STABILITY);
+    }
+    reading.stable = stability == "ST";
+
+    const auto mode = line.substr(MODE_POS, WEIGHT_POS - MODE_POS);
+    if (mode != ",GS" && mode != ",NT") {
+        return fail(ScaleField::MODE);
+    }
+    reading.container = mode != ",GS";
+
+    const auto weight = line.substr(WEIGHT_POS, UNIT_POS - WEIGHT_POS);
+    if (weight.size() < UNIT_POS - WEIGHT_POS ||
+        !parseWeight(weight, reading.weight)) {
+        return fail(ScaleField::WEIGHT);
+    }
+
+    auto unit = line.substr(UNIT_POS, LINE_SIZE - UNIT_POS);
+    const auto unit_char = [](const char c) {
+        return c == ' ' || (c >= 'a' && c <= 'z');
+    };
+    if (unit.size() < LINE_SIZE - UNIT_POS ||
+        !all_of(unit.begin(), unit.end(), unit_char)) {
+        return fail(ScaleField::UNIT);
+    }
+    unit.remove_prefix(std::min(unit.find_first_not_of(' '), unit.size()));
+    reading.unit = unit.substr(0, unit.find(' '));
+
+    if (line.size() != LINE_SIZE) {
+        return fail(ScaleField::LENGTH);
+    }
+    return parsed;
 }
 
-std::optional<double> Scales::getWeight() {
-    std::ifstream serial(conf->uart_path);
-    std::vector<double> measurements;
-    measurements.resize(conf->sample_size);
-    auto measurements_iter = measurements.begin();
+optional<WeightEstimate> Scales::getWeight(
+    const steady_clock::time_point since, const CancellationToken& cancel) {
+    const auto& settling = *conf->settling;
+    const auto deadline = steady_clock::now() + settling.timeout;
+    SettlingDetector detector(settling);
+    uint64_t next = samples.end() - std::min<uint64_t>(samples.end(),
+                                                       settling.window);
+    // Wakes the wait below even while scales are silent
+    const auto wakeup = cancel.onCancel([this]() {
+        { lock_guard lk(line_mx); }
+        line_cv.notify_all();
+    });
     while (true) {
-        std::chrono::seconds timeout(10);
-        auto line = getline_timeout(serial, timeout);
-        if (!line) {
+        for (; next < samples.end(); next++) {
+            const auto sample = samples.get(next);
+            if (!sample || sample->time < since) {
+                continue;
+            }
+            detector.add(*sample);
+            const auto estimate = detector.estimate();
+            if (estimate && estimate->settled) {
+                return estimate;
+            }
+        }
+
+        unique_lock lk(line_mx);
+        const auto wait_until =
+            std::min(deadline, steady_clock::now() + SILENCE_TIMEOUT);
+        const bool received = line_cv.wait_until(lk, wait_until, [&]() {
+            return samples.end() != next || !running || cancel.cancelled();
+        });
+        if (!running || cancel.cancelled()) {
+            return {};
+        }
+        if (!received && steady_clock::now() >= deadline) {
+            const auto best = detector.best();
+            if (best) {
+                spdlog::warn("Weight did not settle in {}s, using {} ± {}",
+                             settling.timeout.count(), best->weight,
+                             best->uncertainty);
+            }
+            return best;
+        }
+        if (!received) {
             return {};
         }
-        std::optional<Scales::State> state = parse(line.value());
-        if (state) {
-            if (state->stable) {
-                *measurements_iter++ = state->weight;
-            } else {
-                measurements_iter = measurements.begin();
+    }
+}
+
+bool Scales::poweredOn(const duration<int> timeout) {
+    unique_lock lk(line_mx);
+    return line_cv.wait_for(lk, timeout, [&]() {
+        return steady_clock::now() - last_line < LINE_INTERVAL;
+    });
+}
+
+optional<ScaleSample> Scales::latest() const { return samples.latest(); }
+
+Scales::Subscription Scales::subscribe(SampleCallback callback) {
+    lock_guard lk(subscribers_mx);
+    const uint64_t id = next_subscriber++;
+    subscribers.emplace(id, std::move(callback));
+    return Subscription(*this, id);
+}
+
+void Scales::readSamples() {
+    while (running) {
+        if (!port.connect()) {
+            unique_lock lk(line_mx);
+            line_cv.wait_for(lk, RECONNECT_INTERVAL,
+                             [&]() { return !running; });
+            continue;
+        }
+        const auto line = port.readLine(READ_TIMEOUT);
+        if (!line) {
+            continue;
+        }
+        const auto now = steady_clock::now();
+        const auto parsed = parse(*line);
+        if (parsed.error == ScaleField::NONE) {
+            const auto& reading = parsed.reading;
+            const ScaleSample sample{now, reading.weight, reading.stable,
+                                     reading.container};
+            samples.push(sample);
+            lock_guard lk(subscribers_mx);
+            for (const auto& [id, callback] : subscribers) {
+                callback(sample);
             }
+        } else {
+            spdlog::debug("Malformed scales line, bad {}: '{}'",
+                          toString(parsed.error), *line);
         }
-        if (measurements_iter == measurements.end()) {
-            std::sort(measurements.begin(), measurements.end());
-            return measurements[measurements.size() / 2];
+        {
+            lock_guard lk(line_mx);
+            last_line = now;
         }
+        line_cv.notify_all();
     }
 }
 
-bool Scales::poweredOn(std::chrono::duration<int> timeout) {
-    std::ifstream serial(conf->uart_path);
-    auto line = getline_timeout(serial, timeout);
-    return line.has_value();
+TEST_CASE("Scales::parse") {
+    SUBCASE("Valid line") {
+        const auto parsed = Scales::parse("ST,NT- 12.345 kg");
+        REQUIRE(parsed.error == ScaleField::NONE);
+        CHECK(parsed.reading.stable);
+        CHECK(parsed.reading.container);
+        CHECK(parsed.reading.weight == -12.345);
+        CHECK(parsed.reading.unit == "kg");
+        CHECK(Scales::parse("US,GS   1 2.5  g ").reading.weight == 12.5);
+    }
+    SUBCASE("Failed field") {
+        CHECK(Scales::parse("").error == ScaleField::STABILITY);
+        CHECK(Scales::parse("XT,GS- 12.345 kg").error ==
+              ScaleField::STABILITY);
+        CHECK(Scales::parse("ST;GS- 12.345 kg").error == ScaleField::MODE);
+        CHECK(Scales::parse("ST,GS+ 12.345 kg").error == ScaleField::WEIGHT);
+        CHECK(Scales::parse("ST,GS-  . .   kg").error == ScaleField::WEIGHT);
+        CHECK(Scales::parse("ST,GS- 12.345 k").error == ScaleField::UNIT);
+        CHECK(Scales::parse("ST,GS- 12.345 Kg").error == ScaleField::UNIT);
+        CHECK(Scales::parse("ST,GS- 12.345 kg\r").error ==
+              ScaleField::LENGTH);
+    }
 }
 
 }  // namespace pawnshop
@@ -0,0 +1,131 @@
+#include "pawnshop/serial_port.hpp"
+
+#include <fcntl.h>
+#include <spdlog/spdlog.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+namespace pawnshop {
+
+SerialConfig::SerialConfig(const toml::table& table) {
+    path = table["uart_path"].value<string>().value();
+    baud_rate = table["baud_rate"].value_or(9600u);
+    parity = table["parity"].value_or("none");
+    vmin = table["vmin"].value_or(uint8_t{0});
+    vtime = table["vtime"].value_or(uint8_t{1});
+}
+
+inline speed_t toSpeed(const uint32_t baud_rate) {
+    switch (baud_rate) {
+        case 1200:
+            return B1200;
+        case 2400:
+            return B2400;
+        case 4800:
+            return B4800;
+        case 9600:
+            return B9600;
+        case 19200:
+            return B19200;
+        case 38400:
+            return B38400;
+        case 57600:
+            return B57600;
+        case 115200:
+            return B115200;
+        default:
+            throw invalid_argument("Unsupported baud rate: " +
+                                   to_string(baud_rate));
+    }
+}
+
+SerialPort::SerialPort(const SerialConfig& conf) : conf(conf) {
+    // Validated early, so config errors show up at startup
+    toSpeed(conf.baud_rate);
+    if (conf.parity != "none" && conf.parity != "even" &&
+        conf.parity != "odd") {
+        throw invalid_argument("Unsupported parity: " + conf.parity);
+    }
+    open();
+}
+
+SerialPort::~SerialPort() { close(); }
+
+bool SerialPort::connect() {
+    if (fd >= 0 && !lost()) {
+        return true;
+    }
+    if (fd >= 0) {
+        spdlog::warn("Lost connection to {}, reconnecting", conf.path);
+        close();
+    }
+    return open();
+}
+
+optional<string> SerialPort::readLine(const chrono::milliseconds timeout) {
+    if (!reader) {
+        return {};
+    }
+    return reader->getline(timeout);
+}
+
+bool SerialPort::open() {
+    fd = ::open(conf.path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        spdlog::warn("Failed to open {}: {}", conf.path, strerror(errno));
+        return false;
+    }
+    termios tty;
+    if (tcgetattr(fd, &tty) != 0) {
+        spdlog::warn("{} is not a terminal: {}", conf.path, strerror(errno));
+        close();
+        return false;
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, toSpeed(conf.baud_rate));
+    cfsetospeed(&tty, toSpeed(conf.baud_rate));
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(PARENB | PARODD);
+    if (conf.parity != "none") {
+        tty.c_cflag |= PARENB;
+        tty.c_iflag |= INPCK;
+    }
+    if (conf.parity == "odd") {
+        tty.c_cflag |= PARODD;
+    }
+    tty.c_cc[VMIN] = conf.vmin;
+    tty.c_cc[VTIME] = conf.vtime;
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        spdlog::warn("Failed to configure {}: {}", conf.path, strerror(errno));
+        close();
+        return false;
+    }
+    // Bytes received before the port was configured are garbage
+    tcflush(fd, TCIFLUSH);
+
+    reader.emplace(fd);
+    spdlog::info("Opened {} at {} baud", conf.path, conf.baud_rate);
+    return true;
+}
+
+void SerialPort::close() {
+    reader.reset();
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool SerialPort::lost() const {
+    termios tty;
+    // Descriptor of removed device fails every request
+    return !reader || reader->failed() || tcgetattr(fd, &tty) != 0;
+}
+
+}  // namespace pawnshop
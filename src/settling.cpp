@@ -0,0 +1,197 @@
+#include "pawnshop/settling.hpp"
+
+#include <doctest/doctest.h>
+#include <toml++/toml.h>
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace pawnshop {
+
+SettlingConfig::SettlingConfig(const toml::table& table) {
+    // Defaults wait for sample_size consecutive stable samples, as scales
+    // were read before
+    window = table["sample_size"].value_or(size_t{20});
+    if (window < 2) {
+        throw invalid_argument("sample_size must be at least 2");
+    }
+    estimator = parseEstimator(table["estimator"].value_or("median"));
+    trim = table["trim"].value_or(0.1);
+    if (trim < 0 || trim >= 0.5) {
+        throw invalid_argument("trim must be in range [0, 0.5)");
+    }
+    mad_threshold = table["mad_threshold"].value_or(3.0);
+    tolerance = table["tolerance"].value_or(numeric_limits<double>::infinity());
+    max_drift = table["max_drift"].value_or(numeric_limits<double>::infinity());
+    use_stable_flag = table["use_stable_flag"].value_or(true);
+    timeout = seconds(table["settling_timeout"].value_or(60));
+}
+
+SettlingDetector::SettlingDetector(const SettlingConfig& conf)
+    : conf(conf), weights(conf.window) {}
+
+void SettlingDetector::add(const ScaleSample& sample) {
+    if (window.empty()) {
+        origin_time = sample.time;
+        origin_weight = sample.weight;
+    }
+    window.push_back(sample);
+    weights.push(sample.weight);
+    update(sample, true);
+    if (window.size() > conf.window) {
+        update(window.front(), false);
+        window.pop_front();
+    }
+    current.reset();
+}
+
+optional<WeightEstimate> SettlingDetector::estimate() {
+    if (window.size() < conf.window) {
+        return {};
+    }
+    return compute();
+}
+
+optional<WeightEstimate> SettlingDetector::best() {
+    if (!window.empty()) {
+        compute();
+    }
+    return best_estimate;
+}
+
+void SettlingDetector::update(const ScaleSample& sample, const bool added) {
+    const double sign = added ? 1 : -1;
+    const double t = duration<double>(sample.time - origin_time).count();
+    const double w = sample.weight - origin_weight;
+    sum_t += sign * t;
+    sum_w += sign * w;
+    sum_tt += sign * t * t;
+    sum_tw += sign * t * w;
+    if (!sample.stable) {
+        added ? unstable++ : unstable--;
+    }
+}
+
+const WeightEstimate& SettlingDetector::compute() {
+    if (current) {
+        return *current;
+    }
+    const double n = window.size();
+    const double var_t = sum_tt - sum_t * sum_t / n;
+    const double cov = sum_tw - sum_t * sum_w / n;
+
+    const auto stat =
+        weights.estimate(conf.estimator, conf.trim, conf.mad_threshold);
+    WeightEstimate estimate;
+    estimate.weight = stat.value;
+    estimate.uncertainty = stat.uncertainty;
+    // Slope of least squares fit over time the window spans
+    const double span =
+        duration<double>(window.back().time - window.front().time).count();
+    estimate.drift = var_t > 0 ? cov / var_t * span : 0;
+    estimate.settled = window.size() >= conf.window &&
+                       estimate.uncertainty <= conf.tolerance &&
+                       abs(estimate.drift) <= conf.max_drift &&
+                       (!conf.use_stable_flag || unstable == 0);
+    current = estimate;
+
+    // Full windows are preferred, few close samples say little
+    const bool full = window.size() >= conf.window;
+    if (!best_estimate || (full && !best_full) ||
+        (full == best_full &&
+         estimate.uncertainty < best_estimate->uncertainty)) {
+        best_estimate = estimate;
+        best_full = full;
+    }
+    return *current;
+}
+
+TEST_CASE("SettlingDetector") {
+    using namespace std::string_view_literals;
+
+    toml::table tbl = toml::parse(R"(
+        sample_size = 5
+        estimator = 'mean'
+        tolerance = 0.01
+        max_drift = 0.01
+    )"sv);
+    SettlingConfig conf(tbl);
+    SettlingDetector detector(conf);
+    CHECK(!detector.best());
+
+    steady_clock::time_point time;
+    const auto add = [&](const double weight, const bool stable = true) {
+        time += 100ms;
+        detector.add({time, weight, stable, false});
+    };
+
+    SUBCASE("Settles on quiet samples") {
+        for (const double w : {10.0, 10.02, 10.0, 10.01, 10.0}) {
+            add(w);
+        }
+        REQUIRE(detector.estimate());
+        CHECK(detector.estimate()->settled);
+        CHECK(detector.estimate()->weight == doctest::Approx(10.006));
+        CHECK(detector.estimate()->uncertainty < 0.01);
+    }
+    SUBCASE("Waits for window to be full") {
+        for (int i = 0; i < 4; i++) {
+            add(10.0);
+        }
+        CHECK(!detector.estimate());
+        REQUIRE(detector.best());
+        CHECK(!detector.best()->settled);
+    }
+    SUBCASE("Drift is not settled") {
+        for (int i = 0; i < 5; i++) {
+            add(10.0 + i * 0.005);
+        }
+        CHECK(detector.estimate()->drift == doctest::Approx(0.02));
+        CHECK(!detector.estimate()->settled);
+    }
+    SUBCASE("Unstable flag") {
+        for (int i = 0; i < 5; i++) {
+            add(10.0, i != 2);
+        }
+        CHECK(!detector.estimate()->settled);
+        add(10.0);
+        add(10.0);
+        CHECK(!detector.estimate()->settled);
+        add(10.0);
+        CHECK(detector.estimate()->settled);
+    }
+    SUBCASE("Best estimate of noisy samples") {
+        for (const double w : {10.0, 12.0, 10.0, 12.0, 10.0, 10.5, 10.4}) {
+            add(w);
+        }
+        CHECK(!detector.estimate()->settled);
+        REQUIRE(detector.best());
+        CHECK(detector.best()->uncertainty ==
+              doctest::Approx(detector.estimate()->uncertainty));
+    }
+    SUBCASE("Best keeps an earlier estimated window") {
+        for (int i = 0; i < 5; i++) {
+            add(10.0 + (i % 2) * 0.01);
+        }
+        const auto quiet = detector.estimate();
+        for (const double w : {12.0, 8.0}) {
+            add(w);
+        }
+        REQUIRE(detector.best());
+        CHECK(detector.best()->weight == doctest::Approx(quiet->weight));
+        CHECK(detector.best()->uncertainty < 0.01);
+    }
+    SUBCASE("Drift over a long run matches a fresh window") {
+        for (int i = 0; i < 2000; i++) {
+            add(500.0 + i * 0.001);
+        }
+        // 0.001g per 100ms over the 400ms window
+        CHECK(detector.estimate()->drift == doctest::Approx(0.004));
+    }
+}
+
+}  // namespace pawnshop
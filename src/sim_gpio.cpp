@@ -0,0 +1,204 @@
+#include "pawnshop/sim_gpio.hpp"
+
+#include <doctest/doctest.h>
+
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace pawnshop {
+namespace gpio {
+
+class SimulatedOutputs : public Outputs {
+public:
+    SimulatedOutputs(SimulatedBackend& backend, const vector<size_t>& pins)
+        : backend(backend), pins(pins) {}
+    void setValues(const vector<int>& values) override {
+        backend.write(pins, values);
+    }
+
+private:
+    SimulatedBackend& backend;
+    const vector<size_t> pins;
+};
+
+class SimulatedInput : public Input {
+public:
+    SimulatedInput(const SimulatedBackend& backend, const size_t pin)
+        : backend(backend), pin(pin) {}
+    int getValue() const override { return backend.read(pin); }
+
+private:
+    const SimulatedBackend& backend;
+    const size_t pin;
+};
+
+SimulatedBackend::SimulatedBackend(vector<SimulatedAxis> conf) {
+    for (size_t i = 0; i < conf.size(); i++) {
+        clock_axes[conf[i].clock_pin] = i;
+        axes.push_back({conf[i]});
+    }
+}
+
+/**
+ * @returns Description of axes in config for simulation
+ */
+inline vector<SimulatedAxis> simulatedAxes(const RailsConfig& conf) {
+    vector<SimulatedAxis> axes;
+    for (const auto& axis : conf.axes) {
+        const double step_length = axis->length / axis->steps;
+        axes.push_back({axis->motor->clock_pin, axis->motor->direction_pin,
+                        axis->negative->pin, axis->motor->counter_clockwire,
+                        axis->steps, 0,
+                        static_cast<int64_t>(std::ceil(
+                            axis->homing_overtravel / step_length))});
+    }
+    return axes;
+}
+
+SimulatedBackend::SimulatedBackend(const RailsConfig& conf)
+    : SimulatedBackend(simulatedAxes(conf)) {}
+
+unique_ptr<Outputs> SimulatedBackend::requestOutputs(const vector<size_t>& pins,
+                                                     const string&) {
+    write(pins, vector<int>(pins.size(), 0));
+    return make_unique<SimulatedOutputs>(*this, pins);
+}
+
+unique_ptr<Input> SimulatedBackend::requestInput(const size_t pin,
+                                                 const string&) {
+    return make_unique<SimulatedInput>(*this, pin);
+}
+
+void SimulatedBackend::write(const vector<size_t>& pins,
+                             const vector<int>& values) {
+    const auto now = chrono::steady_clock::now();
+    std::lock_guard lk(mx);
+    for (size_t i = 0; i < pins.size(); i++) {
+        int& level = levels[pins[i]];
+        const int value = values[i] != 0;
+        if (level == value) {
+            continue;
+        }
+        level = value;
+        if (recording) {
+            edges.push_back({now, pins[i], value != 0});
+        }
+        const auto axis = clock_axes.find(pins[i]);
+        if (value && axis != clock_axes.end()) {
+            step(axes[axis->second]);
+        }
+    }
+}
+
+void SimulatedBackend::step(AxisState& axis) {
+    const bool positive = levels[axis.conf.direction_pin] ^ axis.conf.inverted;
+    const int64_t next = axis.conf.position + (positive ? 1 : -1);
+    if (next < -axis.conf.overtravel || next > axis.conf.steps) {
+        axis.stalls++;
+        return;
+    }
+    axis.conf.position = next;
+}
+
+int SimulatedBackend::read(const size_t pin) const {
+    std::lock_guard lk(mx);
+    for (const auto& axis : axes) {
+        if (axis.conf.limit_pin == pin) {
+            return axis.conf.position > 0;
+        }
+    }
+    const auto level = levels.find(pin);
+    return level == levels.end() ? 0 : level->second;
+}
+
+int64_t SimulatedBackend::getPosition(const size_t axis) const {
+    std::lock_guard lk(mx);
+    return axes.at(axis).conf.position;
+}
+
+void SimulatedBackend::setPosition(const size_t axis, const int64_t steps) {
+    std::lock_guard lk(mx);
+    axes.at(axis).conf.position = steps;
+}
+
+uint64_t SimulatedBackend::getStalls(const size_t axis) const {
+    std::lock_guard lk(mx);
+    return axes.at(axis).stalls;
+}
+
+void SimulatedBackend::setRecording(const bool enabled) {
+    std::lock_guard lk(mx);
+    recording = enabled;
+}
+
+vector<SimulatedBackend::Edge> SimulatedBackend::takeEdges() {
+    std::lock_guard lk(mx);
+    return std::exchange(edges, {});
+}
+
+TEST_CASE("SimulatedBackend") {
+    SimulatedBackend sim({{1, 2, 3, false, 100, 10}, {4, 5, 6, true, 100}});
+    auto clocks = sim.requestOutputs({1, 4}, "test");
+    auto dirs = sim.requestOutputs({2, 5}, "test");
+    auto x_limit = sim.requestInput(3, "test");
+    auto y_limit = sim.requestInput(6, "test");
+    CHECK(x_limit->getValue() == 1);
+    CHECK(y_limit->getValue() == 0);
+
+    SUBCASE("Counts rising edges in direction") {
+        dirs->setValues({1, 0});
+        for (size_t i = 0; i < 5; i++) {
+            clocks->setValues({1, 1});
+            clocks->setValues({0, 0});
+        }
+        CHECK(sim.getPosition(0) == 15);
+        CHECK(sim.getPosition(1) == 5);
+        dirs->setValues({0, 1});
+        clocks->setValues({1, 1});
+        CHECK(sim.getPosition(0) == 14);
+        CHECK(sim.getPosition(1) == 4);
+    }
+
+    SUBCASE("Stalls at the ends") {
+        dirs->setValues({0, 0});
+        for (size_t i = 0; i < 12; i++) {
+            clocks->setValues({1, 0});
+            clocks->setValues({0, 0});
+        }
+        CHECK(sim.getPosition(0) == 0);
+        CHECK(sim.getStalls(0) == 2);
+        CHECK(x_limit->getValue() == 0);
+    }
+
+    SUBCASE("Overtravel past the switch") {
+        SimulatedBackend overtravel({{1, 2, 3, false, 100, 1, 3}});
+        auto clock = overtravel.requestOutputs({1}, "test");
+        auto limit = overtravel.requestInput(3, "test");
+        for (size_t i = 0; i < 6; i++) {
+            clock->setValues({1});
+            clock->setValues({0});
+        }
+        CHECK(overtravel.getPosition(0) == -3);
+        CHECK(overtravel.getStalls(0) == 2);
+        CHECK(limit->getValue() == 0);
+    }
+
+    SUBCASE("Records edges") {
+        sim.takeEdges();
+        clocks->setValues({1, 0});
+        clocks->setValues({1, 0});
+        clocks->setValues({0, 0});
+        auto edges = sim.takeEdges();
+        REQUIRE(edges.size() == 2);
+        CHECK(edges[0].pin == 1);
+        CHECK(edges[0].high);
+        CHECK_FALSE(edges[1].high);
+        CHECK(edges[0].time <= edges[1].time);
+        CHECK(sim.takeEdges().empty());
+    }
+}
+
+}  // namespace gpio
+}  // namespace pawnshop
@@ -0,0 +1,87 @@
+#include "pawnshop/step_bus.hpp"
+
+#include <doctest/doctest.h>
+
+#include "pawnshop/sim_gpio.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace pawnshop {
+
+StepBus::StepBus(gpio::Backend& backend, const vector<size_t>& clock_pins,
+                 const vector<size_t>& dir_pins, const nanoseconds dir_setup)
+    : clock_lines(backend.requestOutputs(clock_pins, "pawnshop-motor")),
+      dir_lines(backend.requestOutputs(dir_pins, "pawnshop-motor")),
+      clock_values(clock_pins.size(), 0),
+      dir_values(dir_pins.size(), 0),
+      dir_setup(dir_setup) {}
+
+void StepBus::setClocks(const Mask channels, const bool high) {
+    if (channels == 0) {
+        return;
+    }
+    // Only rising edges flush directions, a change written on a falling edge
+    // could be followed by the next rising one sooner than setup time
+    if (high && dir_pending) {
+        dir_lines->setValues(dir_values);
+        dir_pending = false;
+        // Microseconds at most, too short to sleep. Step timer catches up on
+        // the delay, since its deadlines are absolute.
+        const auto ready = steady_clock::now() + dir_setup;
+        while (steady_clock::now() < ready) {
+        }
+    }
+    for (size_t i = 0; i < clock_values.size(); i++) {
+        if (channels & (Mask{1} << i)) {
+            clock_values[i] = high;
+        }
+    }
+    clock_lines->setValues(clock_values);
+}
+
+void StepBus::setDirection(const size_t channel, const bool high) {
+    if (dir_values[channel] != high) {
+        dir_values[channel] = high;
+        dir_pending = true;
+    }
+}
+
+size_t StepBus::size() const { return clock_values.size(); }
+
+TEST_CASE("StepBus") {
+    gpio::SimulatedBackend sim({{1, 2, 3, false, 100, 10}});
+    StepBus bus(sim, {1}, {2}, 50us);
+    sim.takeEdges();
+
+    bus.setDirection(0, true);
+    bus.setClocks(1, true);
+    bus.setClocks(1, false);
+    bus.setClocks(1, true);
+    const auto edges = sim.takeEdges();
+    REQUIRE(edges.size() == 4);
+    CHECK(edges[0].pin == 2);
+    CHECK(edges[1].pin == 1);
+    CHECK(edges[1].time - edges[0].time >= 50us);
+    // Steps in the same direction are not delayed
+    CHECK(edges[3].time - edges[2].time < 50us);
+    CHECK(sim.getPosition(0) == 12);
+
+    SUBCASE("Falling edge keeps direction pending") {
+        bus.setDirection(0, false);
+        bus.setClocks(1, false);
+        const auto falling = sim.takeEdges();
+        REQUIRE(falling.size() == 1);
+        CHECK(falling[0].pin == 1);
+
+        bus.setClocks(1, true);
+        const auto rising = sim.takeEdges();
+        REQUIRE(rising.size() == 2);
+        CHECK(rising[0].pin == 2);
+        CHECK(rising[1].pin == 1);
+        CHECK(rising[1].time - rising[0].time >= 50us);
+    }
+}
+
+}  // namespace pawnshop
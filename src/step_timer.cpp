@@ -0,0 +1,203 @@
+#include "pawnshop/step_timer.hpp"
+
+#include <doctest/doctest.h>
+#include <spdlog/spdlog.h>
+#include <time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <thread>
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace pawnshop {
+
+// steady_clock is CLOCK_MONOTONIC, so deadlines are on the same clock
+inline void sleepAbsolute(const steady_clock::time_point time) {
+    const auto since_epoch = time.time_since_epoch();
+    const auto sec = duration_cast<seconds>(since_epoch);
+    timespec ts;
+    ts.tv_sec = sec.count();
+    ts.tv_nsec = duration_cast<nanoseconds>(since_epoch - sec).count();
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+           EINTR) {
+    }
+}
+
+void JitterHistogram::record(const nanoseconds error) {
+    const int64_t abs_error = std::abs(error.count());
+    const size_t bucket = abs_error / BUCKET_WIDTH.count();
+    if (bucket < BUCKET_COUNT) {
+        buckets[bucket].fetch_add(1, memory_order_relaxed);
+    } else {
+        overflow.fetch_add(1, memory_order_relaxed);
+    }
+    int64_t prev_max = max_error.load(memory_order_relaxed);
+    while (abs_error > prev_max &&
+           !max_error.compare_exchange_weak(prev_max, abs_error,
+                                            memory_order_relaxed)) {
+    }
+}
+
+void JitterHistogram::recordOverrun() {
+    overrun_count.fetch_add(1, memory_order_relaxed);
+}
+
+void JitterHistogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, memory_order_relaxed);
+    }
+    overflow.store(0, memory_order_relaxed);
+    max_error.store(0, memory_order_relaxed);
+    overrun_count.store(0, memory_order_relaxed);
+}
+
+uint64_t JitterHistogram::count() const {
+    uint64_t total = overflow.load(memory_order_relaxed);
+    for (const auto& bucket : buckets) {
+        total += bucket.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+uint64_t JitterHistogram::overruns() const {
+    return overrun_count.load(memory_order_relaxed);
+}
+
+nanoseconds JitterHistogram::percentile(const double q) const {
+    const uint64_t total = count();
+    if (total == 0) {
+        return 0ns;
+    }
+    const auto target = static_cast<uint64_t>(std::ceil(q * total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++) {
+        seen += buckets[i].load(memory_order_relaxed);
+        if (seen >= std::max<uint64_t>(target, 1)) {
+            return std::min<nanoseconds>(BUCKET_WIDTH * (i + 1), max());
+        }
+    }
+    return max();
+}
+
+nanoseconds JitterHistogram::max() const {
+    return nanoseconds{max_error.load(memory_order_relaxed)};
+}
+
+StepTimer::StepTimer() { start(); }
+
+void StepTimer::calibrate() {
+    // Measure how late the scheduler wakes us up after absolute sleeps
+    nanoseconds latency{0};
+    for (size_t i = 0; i < 20; i++) {
+        const auto target = clock::now() + 100us;
+        sleepAbsolute(target);
+        latency = std::max(latency, duration_cast<nanoseconds>(
+                                        clock::now() - target));
+    }
+    spin_threshold = std::clamp<nanoseconds>(latency + latency / 2, 5us,
+                                             500us);
+    spdlog::debug("Step timer spins for last {} us before deadlines",
+                  duration_cast<microseconds>(spin_threshold).count());
+}
+
+void StepTimer::start() {
+    deadline = clock::now();
+    has_prev_step = false;
+}
+
+void StepTimer::sleep(const nanoseconds interval) {
+    deadline += interval;
+    const auto now = clock::now();
+    // Catching up would compress following intervals below the profile,
+    // steps continue from now at their planned spacing instead
+    if (interval > 0ns && now - deadline > interval) {
+        histogram.recordOverrun();
+        deadline = now;
+        return;
+    }
+    sleepUntil(deadline);
+}
+
+void StepTimer::recordStep() {
+    const auto now = clock::now();
+    if (has_prev_step) {
+        histogram.record((now - prev_step_time) -
+                         (deadline - prev_step_deadline));
+    }
+    has_prev_step = true;
+    prev_step_time = now;
+    prev_step_deadline = deadline;
+}
+
+const JitterHistogram& StepTimer::jitter() const { return histogram; }
+
+nanoseconds StepTimer::spinThreshold() const { return spin_threshold; }
+
+void StepTimer::sleepUntil(const clock::time_point time) const {
+    const auto wake_up = time - spin_threshold;
+    if (wake_up > clock::now()) {
+        sleepAbsolute(wake_up);
+    }
+    while (clock::now() < time) {
+    }
+}
+
+TEST_CASE("JitterHistogram") {
+    JitterHistogram h;
+
+    SUBCASE("Empty") {
+        CHECK(h.count() == 0);
+        CHECK(h.percentile(0.99) == 0ns);
+    }
+
+    SUBCASE("Percentiles") {
+        for (int i = 0; i < 90; i++) {
+            h.record(50ns);
+        }
+        for (int i = 0; i < 9; i++) {
+            h.record(-1500ns);
+        }
+        h.record(1ms);
+
+        CHECK(h.count() == 100);
+        CHECK(h.percentile(0.5) == 100ns);
+        CHECK(h.percentile(0.99) == 1600ns);
+        CHECK(h.percentile(1.0) == 1ms);
+        CHECK(h.max() == 1ms);
+
+        h.recordOverrun();
+        CHECK(h.overruns() == 1);
+        CHECK(h.count() == 100);
+
+        h.reset();
+        CHECK(h.count() == 0);
+        CHECK(h.max() == 0ns);
+        CHECK(h.overruns() == 0);
+    }
+}
+
+TEST_CASE("StepTimer") {
+    StepTimer timer;
+    timer.calibrate();
+    CHECK(timer.spinThreshold() >= 5us);
+    CHECK(timer.spinThreshold() <= 500us);
+
+    SUBCASE("Resyncs after overrun") {
+        timer.start();
+        timer.sleep(1ms);
+        // Stepping thread preempted for many intervals
+        this_thread::sleep_for(20ms);
+        timer.sleep(1ms);
+        CHECK(timer.jitter().overruns() >= 1);
+        // Deadline moved to the present, so next step isn't emitted at once
+        const auto before = steady_clock::now();
+        timer.sleep(1ms);
+        CHECK(steady_clock::now() - before >= 900us);
+    }
+}
+
+}  // namespace pawnshop
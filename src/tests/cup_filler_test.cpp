@@ -0,0 +1,92 @@
+#include <doctest/doctest.h>
+#include <fmt/format.h>
+#include <toml++/toml.h>
+
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include "pawnshop/cup_filler.hpp"
+#include "pawnshop/scales.hpp"
+#include "pawnshop/util.hpp"
+#include "sim_scales.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace pawnshop {
+
+TEST_CASE("CupFiller") {
+    // Water pours in with exponentially decreasing flow
+    ScaleEmulator emulator({{200ms, 50.0}, {10s, 70.0, 500ms}}, 50.0);
+    const auto conf = toml::parse(fmt::format("uart_path = '{}'",
+                                              emulator.path()));
+    Scales scales(make_unique<ScalesConfig>(conf));
+    REQUIRE(scales.poweredOn(seconds(1)));
+    this_thread::sleep_until(emulator.startTime() + 200ms);
+
+    optional<double> requested;
+    optional<steady_clock::time_point> stopped;
+    CupFiller filler(
+        scales, [&](const double amount) { requested = amount; },
+        [&]() { stopped = steady_clock::now(); });
+
+    SUBCASE("Stops at target") {
+        const auto result = filler.fill(50.0, 64.0, 5s);
+        CHECK(result.reached);
+        CHECK(result.weight >= 64.0);
+        CHECK(requested == 14.0);
+        // First line over target, lines are 0.24g apart around it
+        CHECK(result.weight < 64.5);
+        REQUIRE(stopped);
+        // Only a gross delay, weight rises 2g in about 200ms there
+        CHECK(emulator.weightAt(*stopped - emulator.startTime()) < 66.0);
+    }
+    SUBCASE("Timeout") {
+        const auto result = filler.fill(50.0, 80.0, 500ms);
+        CHECK(!result.reached);
+        CHECK(result.weight < 80.0);
+        CHECK(stopped);
+    }
+
+    SUBCASE("Cancelled") {
+        const CancellationToken cancel;
+        thread canceller([&]() {
+            this_thread::sleep_for(200ms);
+            cancel.cancel();
+        });
+        const auto result = filler.fill(50.0, 80.0, 5s, cancel);
+        canceller.join();
+        CHECK(!result.reached);
+        CHECK(result.time < 1s);
+        CHECK(stopped);
+    }
+}
+
+TEST_CASE("Cancelling filling on silent scales") {
+    ScaleEmulator emulator({{500ms, 50.0}, {100ms, 0.0, 0ms, 0, false, true}});
+    const auto conf = toml::parse(fmt::format("uart_path = '{}'",
+                                              emulator.path()));
+    Scales scales(make_unique<ScalesConfig>(conf));
+    REQUIRE(scales.poweredOn(seconds(1)));
+    this_thread::sleep_until(emulator.startTime() + 600ms);
+
+    bool stopped = false;
+    CupFiller filler(
+        scales, [](double) {}, [&]() { stopped = true; });
+    const CancellationToken cancel;
+    thread canceller([&]() {
+        this_thread::sleep_for(200ms);
+        cancel.cancel();
+    });
+    const auto result = filler.fill(50.0, 80.0, 30s, cancel);
+    canceller.join();
+    // Without a wakeup pump would run until the 30s timeout
+    CHECK(result.time < 5s);
+    CHECK(!result.reached);
+    CHECK(stopped);
+}
+
+}  // namespace pawnshop
@@ -0,0 +1,88 @@
+#include <doctest/doctest.h>
+
+#include <algorithm>
+#include <optional>
+#include <random>
+#include <regex>
+#include <stdexcept>
+#include <string>
+
+#include "pawnshop/scales.hpp"
+
+using namespace std;
+
+namespace pawnshop {
+
+namespace {
+
+/**
+ * Parser that was used before, kept as a reference for the current one
+ */
+optional<ScaleReading> parseWithRegex(const string& line) {
+    const regex entry_format("(ST|US),(GS|NT)([\\- ][0-9\\. ]{7})([a-z ]{3})",
+                             regex_constants::ECMAScript);
+    smatch submatch;
+    if (!regex_match(line, submatch, entry_format)) {
+        return {};
+    }
+    string weight = submatch[3];
+    weight.erase(remove(weight.begin(), weight.end(), ' '), weight.end());
+    ScaleReading reading;
+    try {
+        reading.weight = stod(weight);
+    } catch (const invalid_argument&) {
+        return {};
+    }
+    reading.stable = submatch[1] == "ST";
+    reading.container = submatch[2] != "GS";
+    return reading;
+}
+
+}  // namespace
+
+TEST_CASE("Scales::parse matches regex parser") {
+    // Valid lines with a few characters replaced, inserted or removed
+    const string alphabet = "STUGN, -.0123456789gkz\r";
+    mt19937 gen(42);
+    const auto pick = [&](const string& chars) {
+        return chars[uniform_int_distribution<size_t>(
+            0, chars.size() - 1)(gen)];
+    };
+    for (int i = 0; i < 20000; i++) {
+        string line = string(pick("SU") == 'S' ? "ST" : "US") +
+                      (pick("GN") == 'G' ? ",GS" : ",NT") + pick("- ");
+        for (int j = 0; j < 7; j++) {
+            line += pick("0123456789.   ");
+        }
+        for (int j = 0; j < 3; j++) {
+            line += pick("gk  ");
+        }
+        const int mutations = uniform_int_distribution<int>(0, 3)(gen);
+        for (int j = 0; j < mutations && !line.empty(); j++) {
+            const size_t pos =
+                uniform_int_distribution<size_t>(0, line.size() - 1)(gen);
+            switch (uniform_int_distribution<int>(0, 2)(gen)) {
+                case 0:
+                    line[pos] = pick(alphabet);
+                    break;
+                case 1:
+                    line.insert(pos, 1, pick(alphabet));
+                    break;
+                default:
+                    line.erase(pos, 1);
+            }
+        }
+
+        const auto expected = parseWithRegex(line);
+        const auto parsed = Scales::parse(line);
+        CAPTURE(line);
+        REQUIRE((parsed.error == ScaleField::NONE) == expected.has_value());
+        if (expected) {
+            CHECK(parsed.reading.weight == expected->weight);
+            CHECK(parsed.reading.stable == expected->stable);
+            CHECK(parsed.reading.container == expected->container);
+        }
+    }
+}
+
+}  // namespace pawnshop
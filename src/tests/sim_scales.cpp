@@ -0,0 +1,208 @@
+#include "sim_scales.hpp"
+
+#include <doctest/doctest.h>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <termios.h>
+#include <toml++/toml.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#include "pawnshop/scales.hpp"
+#include "pawnshop/util.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace std::chrono_literals;
+
+namespace pawnshop {
+
+ScaleEmulator::ScaleEmulator(vector<EmulatedPhase> profile, const double rate,
+                             const double stable_band, const uint32_t seed)
+    : interval(duration_cast<nanoseconds>(duration<double>(1.0 / rate))),
+      stable_band(stable_band),
+      seed(seed) {
+    if (profile.empty()) {
+        throw invalid_argument("Scales profile is empty");
+    }
+    nanoseconds start{0};
+    double start_weight = profile.front().weight;
+    for (const auto& phase : profile) {
+        phases.push_back({phase, start, start_weight});
+        start += phase.duration;
+        start_weight = weightAt(start - 1ns);
+    }
+
+    master.reset(posix_openpt(O_RDWR | O_NOCTTY));
+    if (master.get() < 0 || grantpt(master.get()) != 0 ||
+        unlockpt(master.get()) != 0) {
+        throw runtime_error(string("Failed to create terminal: ") +
+                            strerror(errno));
+    }
+    slave_path = ptsname(master.get());
+    // Writes are dropped rather than blocked while nobody reads
+    fcntl(master.get(), F_SETFL, fcntl(master.get(), F_GETFL) | O_NONBLOCK);
+    // Held open, so terminal settings stay between readers
+    slave.reset(open(slave_path.c_str(), O_RDWR | O_NOCTTY));
+    termios tty;
+    if (slave.get() < 0 || tcgetattr(slave.get(), &tty) != 0) {
+        throw runtime_error(string("Failed to open terminal: ") +
+                            strerror(errno));
+    }
+    cfmakeraw(&tty);
+    tcsetattr(slave.get(), TCSANOW, &tty);
+
+    start_time = steady_clock::now();
+    writer = thread(&ScaleEmulator::writeLines, this);
+}
+
+ScaleEmulator::~ScaleEmulator() {
+    {
+        lock_guard lk(stop_mx);
+        stopped = true;
+    }
+    stop_cv.notify_all();
+    writer.join();
+}
+
+ScaleEmulator::Descriptor::~Descriptor() { reset(-1); }
+
+void ScaleEmulator::Descriptor::reset(const int fd) {
+    if (this->fd >= 0) {
+        close(this->fd);
+    }
+    this->fd = fd;
+}
+
+const string& ScaleEmulator::path() const { return slave_path; }
+
+double ScaleEmulator::weightAt(const nanoseconds time) const {
+    const auto& phase = phaseAt(time);
+    if (phase.conf.settling == 0ms) {
+        return phase.conf.weight;
+    }
+    const double t = duration<double>(time - phase.start) /
+                     duration<double>(phase.conf.settling);
+    return phase.conf.weight +
+           (phase.start_weight - phase.conf.weight) * exp(-t);
+}
+
+steady_clock::time_point ScaleEmulator::startTime() const {
+    return start_time;
+}
+
+const ScaleEmulator::Phase& ScaleEmulator::phaseAt(
+    const nanoseconds time) const {
+    for (size_t i = 1; i < phases.size(); i++) {
+        if (time < phases[i].start) {
+            return phases[i - 1];
+        }
+    }
+    return phases.back();
+}
+
+void ScaleEmulator::writeLines() {
+    mt19937 gen(seed);
+    auto next = start_time;
+    unique_lock lk(stop_mx);
+    while (!stop_cv.wait_until(lk, next, [&]() { return stopped; })) {
+        const auto time = next - start_time;
+        next += interval;
+        const auto& phase = phaseAt(time);
+        if (phase.conf.off) {
+            continue;
+        }
+        const double weight = weightAt(time);
+        const double noise =
+            phase.conf.noise > 0
+                ? normal_distribution<double>(0, phase.conf.noise)(gen)
+                : 0;
+        const bool stable = !phase.conf.unstable &&
+                            abs(weight - phase.conf.weight) <= stable_band;
+        const double shown = weight + noise;
+        const auto line = fmt::format(
+            "{},GS{}{:7.3f} g \r\n", stable ? "ST" : "US",
+            shown < 0 ? '-' : ' ', std::min(abs(shown), 9999.999));
+        if (write(master.get(), line.data(), line.size()) < 0 &&
+            errno != EAGAIN) {
+            break;
+        }
+    }
+}
+
+TEST_CASE("ScaleEmulator") {
+    ScaleEmulator emulator({{300ms, 0.0, 0ms, 0, false, true},
+                            {100ms, 0.0},
+                            {1500ms, 20.0, 0ms, 0.5, true},
+                            {5s, 12.345, 50ms, 0.0005}},
+                           50.0);
+    CHECK(emulator.weightAt(0s) == 0.0);
+    CHECK(emulator.weightAt(1800ms) == 20.0);
+    CHECK(emulator.weightAt(1950ms) ==
+          doctest::Approx(12.345 + (20.0 - 12.345) * exp(-1.0)));
+
+    const auto conf = toml::parse(fmt::format(R"(
+        uart_path = '{}'
+        sample_size = 10
+        tolerance = 0.001
+        max_drift = 0.002
+        settling_timeout = 1
+    )",
+                                              emulator.path()));
+    Scales scales(make_unique<ScalesConfig>(conf));
+
+    // Scales are off for the first 300ms
+    CHECK(!scales.poweredOn(seconds(0)));
+    CHECK(scales.poweredOn(seconds(1)));
+    CHECK(steady_clock::now() - emulator.startTime() >= 300ms);
+
+    SUBCASE("Unstable burst times out with best estimate") {
+        this_thread::sleep_until(emulator.startTime() + 400ms);
+        const auto estimate = scales.getWeight(steady_clock::now());
+        REQUIRE(estimate);
+        CHECK(!estimate->settled);
+        CHECK(estimate->uncertainty > 0.001);
+        CHECK(estimate->weight == doctest::Approx(20.0).epsilon(0.1));
+    }
+    SUBCASE("Settled weight") {
+        this_thread::sleep_until(emulator.startTime() + 1900ms);
+        const auto estimate = scales.getWeight(steady_clock::now());
+        REQUIRE(estimate);
+        CHECK(estimate->settled);
+        CHECK(abs(estimate->weight - 12.345) < 0.002);
+        CHECK(scales.latest()->stable);
+    }
+}
+
+TEST_CASE("Cancelling weighing on silent scales") {
+    ScaleEmulator emulator({{500ms, 0.0}, {100ms, 0.0, 0ms, 0, false, true}});
+    const auto conf = toml::parse(fmt::format(R"(
+        uart_path = '{}'
+        settling_timeout = 30
+    )",
+                                              emulator.path()));
+    Scales scales(make_unique<ScalesConfig>(conf));
+    REQUIRE(scales.poweredOn(seconds(1)));
+    this_thread::sleep_until(emulator.startTime() + 600ms);
+
+    const CancellationToken cancel;
+    thread canceller([&]() {
+        this_thread::sleep_for(200ms);
+        cancel.cancel();
+    });
+    const auto start = steady_clock::now();
+    const auto estimate = scales.getWeight(start, cancel);
+    // Without a wakeup it would take the 10s silence timeout
+    CHECK(steady_clock::now() - start < 5s);
+    CHECK(!estimate);
+    canceller.join();
+}
+
+}  // namespace pawnshop
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pawnshop {
+
+/**
+ * Part of a scripted weight profile
+ */
+struct EmulatedPhase {
+    std::chrono::milliseconds duration;
+    // Weight approached from the end of previous phase
+    double weight;
+    // Time constant of exponential approach, 0 to jump right to weight
+    std::chrono::milliseconds settling{0};
+    // Standard deviation of noise added to every line
+    double noise = 0;
+    // Lines are flagged unstable for the whole phase, i.e. bumped table
+    bool unstable = false;
+    // Scales send nothing, as if turned off
+    bool off = false;
+};
+
+/**
+ * Scales on a pseudo terminal, sending lines in the same format as the real
+ * ones while following a scripted profile. Last phase lasts forever.
+ * Point uart_path to path() to read them. Built only into tests and
+ * benchmarks, not into the library.
+ */
+class ScaleEmulator {
+public:
+    /**
+     * @param rate: Lines sent per second
+     * @param stable_band: Lines are flagged stable once weight without
+     * noise is that close to target of the phase
+     */
+    ScaleEmulator(std::vector<EmulatedPhase> profile, double rate = 10.0,
+                  double stable_band = 0.005, uint32_t seed = 0);
+    ScaleEmulator(const ScaleEmulator&) = delete;
+    ScaleEmulator& operator=(const ScaleEmulator&) = delete;
+    ~ScaleEmulator();
+
+    /**
+     * @returns Path of terminal scales are connected to
+     */
+    const std::string& path() const;
+    /**
+     * @returns Weight without noise at given time since start of profile
+     */
+    double weightAt(std::chrono::nanoseconds time) const;
+    /**
+     * @returns Time profile has started, phase times count from it
+     */
+    std::chrono::steady_clock::time_point startTime() const;
+
+private:
+    /**
+     * Closes owned descriptor, also when constructor throws half way
+     */
+    class Descriptor {
+    public:
+        Descriptor() = default;
+        Descriptor(const Descriptor&) = delete;
+        Descriptor& operator=(const Descriptor&) = delete;
+        ~Descriptor();
+
+        void reset(int fd);
+        int get() const { return fd; }
+
+    private:
+        int fd = -1;
+    };
+
+    struct Phase {
+        EmulatedPhase conf;
+        std::chrono::nanoseconds start;
+        double start_weight;
+    };
+
+    std::vector<Phase> phases;
+    const std::chrono::nanoseconds interval;
+    const double stable_band;
+    const uint32_t seed;
+    Descriptor master;
+    Descriptor slave;
+    std::string slave_path;
+    std::chrono::steady_clock::time_point start_time;
+
+    std::mutex stop_mx;
+    std::condition_variable stop_cv;
+    bool stopped = false;
+    std::thread writer;
+
+    const Phase& phaseAt(std::chrono::nanoseconds time) const;
+    void writeLines();
+};
+
+}  // namespace pawnshop
@@ -1,10 +1,10 @@
 #include "pawnshop/util.hpp"
 
-#include <atomic>
-#include <chrono>
-#include <fstream>
-#include <iostream>
-#include <mutex>
+#include <doctest/doctest.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
 #include <thread>
 
 using namespace std;
@@ -13,37 +13,175 @@ using namespace std::chrono_literals;
 
 namespace pawnshop {
 
-optional<string> getline_timeout(istream &is, duration<int> timeout) {
-    timed_mutex mx;
-    atomic<bool> stopReading{false};
-    string line;
-    line.reserve(128);
-
-    auto t1 = thread([&]() {
-        lock_guard<timed_mutex> lock(mx);
-        while (!stopReading) {
-            char c;
-            if (is.readsome(&c, 1) > 0) {
-                if (c != '\n') {
-                    line.push_back(c);
-                } else {
-                    break;
-                }
-            }
+LineReader::LineReader(int fd) : fd(fd) { buffer.reserve(MAX_LINE); }
+
+optional<string> LineReader::getline(milliseconds timeout) {
+    const auto deadline = steady_clock::now() + timeout;
+    while (true) {
+        if (auto line = takeLine()) {
+            return line;
         }
-    });
+        const auto now = steady_clock::now();
+        if (error || now >= deadline) {
+            return {};
+        }
+
+        pollfd pfd{fd, POLLIN, 0};
+        // Rounded up, so poll never wakes before deadline
+        const auto wait = ceil<milliseconds>(deadline - now);
+        const int ready = poll(&pfd, 1, wait.count());
+        if (ready == 0 || (ready < 0 && errno == EINTR)) {
+            continue;
+        }
+        if (ready < 0 || (pfd.revents & (POLLERR | POLLNVAL))) {
+            error = true;
+            return {};
+        }
+
+        char chunk[256];
+        const ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        // Readable descriptor without data is closed
+        if (n <= 0) {
+            error = true;
+            return {};
+        }
+        buffer.append(chunk, n);
+    }
+}
 
-    // Wait for t1 to lock mutex
-    auto delay = 100ms;
-    this_thread::sleep_for(delay);
-    if (mx.try_lock_for(timeout - delay)) {
-        t1.join();
-        return line;
-    } else {
-        stopReading = true;
-        t1.join();
+bool LineReader::failed() const { return error; }
+
+optional<string> LineReader::takeLine() {
+    const auto end = buffer.find('\n', scanned);
+    if (end == string::npos) {
+        scanned = buffer.size();
+        // Line noise without line endings is dropped
+        if (buffer.size() > MAX_LINE) {
+            buffer.clear();
+            scanned = 0;
+        }
         return {};
     }
+    size_t size = end;
+    if (size > 0 && buffer[size - 1] == '\r') {
+        size--;
+    }
+    string line = buffer.substr(0, size);
+    buffer.erase(0, end + 1);
+    scanned = 0;
+    return line;
+}
+
+OperationCancelled::OperationCancelled()
+    : runtime_error("Operation cancelled") {}
+
+CancellationToken::Registration::Registration(shared_ptr<State> state,
+                                              const uint64_t id)
+    : state(std::move(state)), id(id) {}
+
+CancellationToken::Registration::Registration(Registration&& other)
+    : state(std::move(other.state)), id(other.id) {}
+
+CancellationToken::Registration::~Registration() {
+    if (state) {
+        lock_guard lk(state->mx);
+        state->callbacks.erase(id);
+    }
+}
+
+CancellationToken::CancellationToken() : state(make_shared<State>()) {}
+
+void CancellationToken::cancel() const {
+    {
+        // Sleeper either sees the flag or gets the notification
+        lock_guard lk(state->mx);
+        if (state->cancelled.exchange(true)) {
+            return;
+        }
+        for (const auto& [id, callback] : state->callbacks) {
+            callback();
+        }
+    }
+    state->cv.notify_all();
+}
+
+bool CancellationToken::cancelled() const { return state->cancelled.load(); }
+
+void CancellationToken::throwIfCancelled() const {
+    if (cancelled()) {
+        throw OperationCancelled();
+    }
+}
+
+bool CancellationToken::sleepFor(const nanoseconds time) const {
+    unique_lock lk(state->mx);
+    return state->cv.wait_for(lk, time, [this]() { return cancelled(); });
+}
+
+CancellationToken::Registration CancellationToken::onCancel(
+    function<void()> callback) const {
+    {
+        lock_guard lk(state->mx);
+        if (!state->cancelled.load()) {
+            const uint64_t id = state->next_callback++;
+            state->callbacks.emplace(id, std::move(callback));
+            return {state, id};
+        }
+    }
+    callback();
+    return {};
+}
+
+TEST_CASE("CancellationToken") {
+    const CancellationToken token;
+    const CancellationToken copy = token;
+    CHECK(!copy.sleepFor(10ms));
+    thread canceller([&]() {
+        this_thread::sleep_for(20ms);
+        token.cancel();
+    });
+    const auto start = steady_clock::now();
+    CHECK(copy.sleepFor(10s));
+    CHECK(steady_clock::now() - start < 1s);
+    CHECK_THROWS_AS(copy.throwIfCancelled(), OperationCancelled);
+    canceller.join();
+
+    int calls = 0;
+    const auto late = token.onCancel([&]() { calls++; });
+    CHECK(calls == 1);
+    const CancellationToken other;
+    {
+        const auto unregistered = other.onCancel([&]() { calls++; });
+    }
+    const auto registered = other.onCancel([&]() { calls++; });
+    other.cancel();
+    other.cancel();
+    CHECK(calls == 2);
+}
+
+TEST_CASE("LineReader") {
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    LineReader reader(fds[0]);
+    const string data = "ST,GS\r\nUS,";
+    REQUIRE(write(fds[1], data.data(), data.size()) == ssize_t(data.size()));
+
+    CHECK(reader.getline(100ms) == "ST,GS");
+    const auto start = steady_clock::now();
+    CHECK(!reader.getline(50ms));
+    CHECK(steady_clock::now() - start >= 50ms);
+    CHECK(!reader.failed());
+
+    REQUIRE(write(fds[1], "NT\n", 3) == 3);
+    CHECK(reader.getline(100ms) == "US,NT");
+
+    close(fds[1]);
+    CHECK(!reader.getline(100ms));
+    CHECK(reader.failed());
+    close(fds[0]);
 }
 
 }  // namespace pawnshop